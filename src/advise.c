@@ -0,0 +1,305 @@
+// advise.c ... suggest a choice vector for a query workload
+// Usage:  ./advise  [-v]  [-s #samples]  RelName  QueryLog  [SampleFile]
+// - QueryLog holds one selection ('v1,v2,...' as for query) per line;
+//   blank lines and lines starting with '#' are skipped
+// - tuples from SampleFile, or a random sample of the relation itself
+//   (at most #samples of them, default ADVISESAMPLE), show how full
+//   each bucket would be
+// - -v shows the estimate for each query
+// For the file as it is now (#pages, depth and split pointer), it
+// estimates the pages each query reads (the buckets that startSelection
+// would visit, and the pages in each) with the relation's choice vector,
+// then searches for one that reads fewer
+
+#include "defs.h"
+#include "select.h"
+#include "tuple.h"
+#include "reln.h"
+#include "chvec.h"
+
+#define USAGE "./advise  [-v]  [-s #samples]  RelName  QueryLog  [SampleFile]"
+#define ADVISESAMPLE 10000
+
+typedef struct {
+	Reln   r;
+	Count  nattrs;
+	Count  nsample;
+	Bits  *attHash;   // hashes of the sample's values, nattrs per tuple
+	double perTuple;  // pages' worth of tuples each sample tuple stands for
+	Count  nq;
+	char ***qvals;    // values of each query
+	Count *count;     // #sample tuples in each bucket
+} Workload;
+
+// keep a random sample of at most max tuples in *sample (reservoir)
+// the tuple is copied only if it is kept; returns the new #tuples seen
+
+static Count sampleTuple(Tuple *sample, Count max, Count seen, Tuple t)
+{
+	Count k = (seen < max) ? seen : (Count)(rand() % (seen+1));
+	if (k < max) {
+		if (seen >= max) free(sample[k]);
+		sample[k] = copyString(t);
+	}
+	return seen + 1;
+}
+
+// the pages read for a bucket holding n sample tuples
+
+static double bucketPages(Workload *w, Count n)
+{
+	double p = n * w->perTuple;
+	Count whole = (Count)p;
+	if (whole < p) whole++;
+	return (whole < 1) ? 1 : whole;
+}
+
+// mean #pages read per query with choice vector cv
+// with each != NULL, also each query's estimate
+
+static double workloadCost(Workload *w, ChVec cv, double *each)
+{
+	HashPlan p;
+	compileHashPlan(cv, hashPlan(w->r)->hash, &p);
+	memset(w->count, 0, npages(w->r) * sizeof(Count));
+	for (Count i = 0; i < w->nsample; i++) {
+		Bits h = planHash(&p, &w->attHash[i*w->nattrs]);
+		w->count[bucketOf(w->r, h)]++;
+	}
+	double total = 0;
+	for (Count q = 0; q < w->nq; q++) {
+		Bits known, unknown;
+		int nb;
+		patternBits(&p, w->qvals[q], w->nattrs, &known, &unknown);
+		PageID *b = computePage(known, unknown, &nb, w->r);
+		double c = 0;
+		for (int k = 0; k < nb; k++) c += bucketPages(w, w->count[b[k]]);
+		free(b);
+		if (each != NULL) each[q] = c;
+		total += c;
+	}
+	return total / w->nq;
+}
+
+// a choice vector taking bit i from attribute att[i], for i < nbits
+// (an attribute's bits are used from its hash's bit 0 up); the rest
+// is filled in as parseChVec does
+
+static void makeChVec(Byte *att, Count nbits, Count nattrs, ChVec cv)
+{
+	Count next[nattrs];
+	for (Count a = 0; a < nattrs; a++) next[a] = 0;
+	for (Count i = 0; i < nbits; i++) {
+		cv[i].att = att[i];
+		cv[i].bit = next[att[i]]++;
+	}
+	fillChVec(cv, nbits, nattrs);
+}
+
+// the first n items of cv, as create takes them
+
+static void chVecString(ChVec cv, Count n, char *buf)
+{
+	buf[0] = '\0';
+	for (Count i = 0; i < n; i++)
+		sprintf(buf + strlen(buf), "%s%d,%d", (i > 0) ? ":" : "",
+		        cv[i].att, cv[i].bit);
+}
+
+// Main ... process args, estimate, search
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG+MAXTUPLEN];  // buffer for error messages
+	int offset = 0; // adapt offset for options
+	int verbose = 0;  // show each query's estimate
+	int maxsample = ADVISESAMPLE;  // most tuples to sample
+
+	// process command-line args
+
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0) {
+			offset += 1;  verbose = 1;
+		}
+		else if (strcmp(argv[offset+1], "-s") == 0 && offset+2 < argc) {
+			if (!convert(argv[offset+2], &maxsample) || maxsample < 1)
+				fatal(USAGE);
+			offset += 2;
+		}
+		else
+			fatal(USAGE);
+	}
+	if (argc != offset+3 && argc != offset+4) fatal(USAGE);
+	char *rname = argv[offset+1], *qname = argv[offset+2];
+	char *sname = (argc == offset+4) ? argv[offset+3] : NULL;
+
+	if (!existsRelation(rname)) {
+		sprintf(err, "No such relation: %s",rname);
+		fatal(err);
+	}
+	Reln r = openRelation(rname,"rm");
+	Workload w;
+	w.r = r;
+	w.nattrs = nattrs(r);
+
+	// read the queries
+	FILE *qf = fopen(qname, "r");
+	if (qf == NULL) fatal("Can't open query log");
+	// a line of MAXTUPLEN chars or more is too long for a selection
+	char line[MAXTUPLEN+1];
+	Count lineno = 0;
+	Count maxq = 64;
+	char **qtext = malloc(maxq * sizeof(char *));
+	char **qbuf = malloc(maxq * sizeof(char *));
+	w.qvals = malloc(maxq * sizeof(char **));
+	assert(qtext != NULL && qbuf != NULL && w.qvals != NULL);
+	w.nq = 0;
+	while (fgets(line, sizeof(line), qf) != NULL) {
+		lineno++;
+		Count len = strcspn(line, "\n");
+		if (len >= MAXTUPLEN) {
+			sprintf(err, "Line %d of query log is longer than %d chars",
+			        lineno, MAXTUPLEN-1);
+			fatal(err);
+		}
+		line[len] = '\0';
+		if (line[0] == '\0' || line[0] == '#') continue;
+		if (nvals(line) != w.nattrs) {
+			sprintf(err, "Invalid selection in query log: %s", line);
+			fatal(err);
+		}
+		if (w.nq == maxq) {
+			maxq *= 2;
+			qtext = realloc(qtext, maxq * sizeof(char *));
+			qbuf = realloc(qbuf, maxq * sizeof(char *));
+			w.qvals = realloc(w.qvals, maxq * sizeof(char **));
+			assert(qtext != NULL && qbuf != NULL && w.qvals != NULL);
+		}
+		qtext[w.nq] = copyString(line);
+		qbuf[w.nq] = copyString(line);
+		w.qvals[w.nq] = splitTuple(qbuf[w.nq], w.nattrs);
+		w.nq++;
+	}
+	fclose(qf);
+	if (w.nq == 0) fatal("No queries in query log");
+
+	// sample the data
+	Tuple *sample = malloc(maxsample * sizeof(Tuple));
+	assert(sample != NULL);
+	Count seen = 0;
+	srand(0);
+	if (sname != NULL) {
+		FILE *sf = fopen(sname, "r");
+		if (sf == NULL) fatal("Can't open sample file");
+		TupleReader rd = newTupleReader(r, sf);
+		Tuple t;
+		while ((t = nextTuple(rd)) != NULL)
+			seen = sampleTuple(sample, maxsample, seen, t);
+		freeTupleReader(rd);
+		fclose(sf);
+	}
+	else {
+		char all[2*w.nattrs];
+		for (Count a = 0; a < w.nattrs; a++) {
+			all[2*a] = '?';
+			all[2*a+1] = (a < w.nattrs-1) ? ',' : '\0';
+		}
+		Selection s = startSelection(r, all);
+		Tuple t;
+		while ((t = getNextTuple(s)) != NULL)
+			seen = sampleTuple(sample, maxsample, seen, t);
+		closeSelection(s);
+	}
+	if (seen == 0) fatal("No tuples to sample");
+	w.nsample = (seen < maxsample) ? seen : maxsample;
+
+	// hash every value of the sample once; each tuple stands for
+	// ntuples/nsample of the relation's tuples (or just itself), and
+	// takes its recordSpace in pages filled to the target, as the
+	// relation's own size is worked out (see pagesFor in reln.c)
+	HashFunc hash = hashPlan(r)->hash;
+	w.attHash = malloc(w.nsample * w.nattrs * sizeof(Bits));
+	assert(w.attHash != NULL);
+	double bytes = 0;
+	for (Count i = 0; i < w.nsample; i++) {
+		char *c = sample[i];
+		for (Count a = 0; a < w.nattrs; a++) {
+			int len = strcspn(c, ",");
+			w.attHash[i*w.nattrs + a] = hash((unsigned char *)c, len);
+			c += len;
+			if (*c == ',') c++;
+		}
+		bytes += recordSpace(tupLength(sample[i]), pageFlags(r));
+	}
+	double scale = (ntuples(r) > w.nsample) ? (double)ntuples(r)/w.nsample : 1;
+	double perPage = pageCapacity(pagesize(r)) * fillFactor(r) / 100.0;
+	w.perTuple = scale * bytes / w.nsample / perPage;
+	w.count = malloc(npages(r) * sizeof(Count));
+	assert(w.count != NULL);
+
+	// only the low depth+1 bits of a hash place it in a file this size
+	Count nbits = depth(r) + 1;
+	double *now = malloc(w.nq * sizeof(double));
+	double *adv = malloc(w.nq * sizeof(double));
+	assert(now != NULL && adv != NULL);
+	ChVec cur;
+	memcpy(cur, chvec(r), sizeof(ChVec));
+	double curCost = workloadCost(&w, cur, now);
+
+	// choose each bit's attribute in turn, then keep changing single
+	// bits' attributes while that helps
+	Byte att[MAXCHVEC];
+	ChVec cv;
+	double best = 0;
+	for (Count i = 0; i < nbits; i++) {
+		Byte pick = 0;
+		for (Count a = 0; a < w.nattrs; a++) {
+			att[i] = a;
+			makeChVec(att, i+1, w.nattrs, cv);
+			double c = workloadCost(&w, cv, NULL);
+			if (a == 0 || c < best) { best = c; pick = a; }
+		}
+		att[i] = pick;
+	}
+	Bool better = TRUE;
+	while (better) {
+		better = FALSE;
+		for (Count i = 0; i < nbits; i++) {
+			Byte was = att[i];
+			for (Count a = 0; a < w.nattrs; a++) {
+				if (a == was) continue;
+				att[i] = a;
+				makeChVec(att, nbits, w.nattrs, cv);
+				double c = workloadCost(&w, cv, NULL);
+				if (c < best - 1e-9) { best = c; was = a; better = TRUE; }
+			}
+			att[i] = was;
+		}
+	}
+	makeChVec(att, nbits, w.nattrs, cv);
+	best = workloadCost(&w, cv, adv);
+
+	// report
+	char cvbuf[MAXCHVEC*8];
+	printf("%d queries, %d sample tuples, %d pages (d:%d sp:%d)\n",
+	       w.nq, w.nsample, npages(r), depth(r), splitp(r));
+	if (verbose) {
+		printf("%10s %10s  %s\n", "current", "advised", "query");
+		for (Count q = 0; q < w.nq; q++)
+			printf("%10.1f %10.1f  %s\n", now[q], adv[q], qtext[q]);
+	}
+	chVecString(cur, nbits, cvbuf);
+	printf("current: %.1f pages/query  %s\n", curCost, cvbuf);
+	chVecString(cv, nbits, cvbuf);
+	printf("advised: %.1f pages/query  %s\n", best, cvbuf);
+	printf("expected speedup: %.2fx\n", curCost / best);
+
+	for (Count q = 0; q < w.nq; q++) {
+		free(w.qvals[q]); free(qbuf[q]); free(qtext[q]);
+	}
+	for (Count i = 0; i < w.nsample; i++) free(sample[i]);
+	free(sample); free(qtext); free(qbuf); free(w.qvals); free(w.attHash);
+	free(w.count); free(now); free(adv);
+	closeRelation(r);
+	return 0;
+}
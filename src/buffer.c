@@ -0,0 +1,417 @@
+// buffer.c ... shared buffer pool
+// Keeps a fixed number of page frames in memory for a relation
+
+#define _POSIX_C_SOURCE 200809L
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "defs.h"
+#include "buffer.h"
+#include "page.h"
+#include "wal.h"
+
+// A BufPool is a fixed array of page frames plus a frame table
+// - all frames have the page size of the relation using the pool,
+//   and new pages get its page format (PAGE_* flags)
+// - every frame holds at most one (file,pageID) page image
+// - a pinned frame (pin > 0) is never chosen as a victim
+// - dirty frames are written back when evicted or flushed; a flush
+//   writes them in (file,pageID) order
+// - victims are chosen with the CLOCK (second chance) policy
+// - a small hash table maps (file,pageID) to frame index
+// Files opened read-only may instead be mapped into memory (mapFile)
+// - pins on a mapped file return a pointer straight into the mapping
+// - no frame is used and nothing is copied; unpin is a no-op
+// - pages beyond the end of the mapping fall back to frames
+// prefetchPage() asks the kernel to start reading a page that will
+//   be pinned soon, so the I/O overlaps with work on other pages
+// If a write-ahead log is attached (useWal), dirty frames are written
+//   to the log rather than to their files, and pages are read from
+//   the log when it holds a newer image than the file (see wal.c)
+// A pool made by forkBufPool lets another thread read the same files:
+//   it has frames of its own but shares the mappings and log, and
+//   reads pages with pread, since threads can't share a FILE's position
+
+typedef struct {
+	FILE   *file;   // file the page came from (NULL if frame unused)
+	PageID  pid;    // page within that file
+	int     pin;    // number of callers using the page
+	Bool    dirty;  // page modified since it was read?
+	Bool    ref;    // referenced since clock hand last passed?
+	int     next;   // next frame in same hash chain (-1 = end)
+} Frame;
+
+// for sorting frames by the page they hold
+typedef struct {
+	FILE   *file;
+	PageID  pid;
+	int     frame;
+} FrameKey;
+
+#define MAXMAPS 2
+
+typedef struct {
+	FILE   *file;   // file that is mapped
+	char   *base;   // start of mapping
+	Count   npages; // #whole pages in mapping
+} Mapping;
+
+struct BufPoolRep {
+	Count  nframes; // number of frames in pool
+	Count  pagesize; // #bytes in each page
+	Count  pageflags; // format of new pages
+	Frame *frames;  // frame table
+	char  *pages;   // nframes*pagesize bytes of page images
+	int   *hash;    // hash chain heads (-1 = empty)
+	Count  nhash;   // #entries in hash[] (power of 2)
+	Count  clock;   // current position of clock hand
+	Mapping maps[MAXMAPS]; // read-only file mappings
+	Count  nmaps;   // #entries used in maps[]
+	Wal    wal;     // log that receives written pages (or NULL)
+	Bool   forked;  // made by forkBufPool (read-only, shares maps)
+	// statistics
+	Count  nreads;  // #pages read from files
+	Count  nwrites; // #pages written to files
+	Count  nhits;   // #pins satisfied without I/O
+	Count  nprefetch; // #readahead requests issued
+};
+
+// Helpers
+static Count hashSlot(BufPool bp, FILE *f, PageID pid);
+static int findFrame(BufPool bp, FILE *f, PageID pid);
+static Mapping *findMapping(BufPool bp, FILE *f);
+static int grabFrame(BufPool bp);
+static void dropFrame(BufPool bp, int i);
+static void writeFrame(BufPool bp, int i);
+static int cmpFrame(const void *a, const void *b);
+
+#define framePage(bp,i) ((Page)((bp)->pages + (size_t)(i)*(bp)->pagesize))
+
+// set up an empty pool with nframes frames of pagesize bytes
+// pages added through the pool are formatted with pageflags
+
+BufPool newBufPool(Count nframes, Count pagesize, Count pageflags)
+{
+	assert(nframes > 0 && validPageSize(pagesize));
+	BufPool bp = malloc(sizeof(struct BufPoolRep));
+	assert(bp != NULL);
+	bp->nframes = nframes;
+	bp->pagesize = pagesize;
+	bp->pageflags = pageflags;
+	bp->frames = malloc(nframes*sizeof(Frame));
+	assert(bp->frames != NULL);
+	bp->pages = malloc((size_t)nframes*pagesize);
+	assert(bp->pages != NULL);
+	bp->nhash = 1;
+	while (bp->nhash < 2*nframes) bp->nhash <<= 1;
+	bp->hash = malloc(bp->nhash*sizeof(int));
+	assert(bp->hash != NULL);
+	for (Count h = 0; h < bp->nhash; h++) bp->hash[h] = -1;
+	for (Count i = 0; i < nframes; i++) {
+		bp->frames[i].file = NULL;
+		bp->frames[i].pid = NO_PAGE;
+		bp->frames[i].pin = 0;
+		bp->frames[i].dirty = FALSE;
+		bp->frames[i].ref = FALSE;
+		bp->frames[i].next = -1;
+	}
+	bp->clock = 0;
+	bp->nmaps = 0;
+	bp->wal = NULL;
+	bp->forked = FALSE;
+	bp->nreads = bp->nwrites = bp->nhits = bp->nprefetch = 0;
+	return bp;
+}
+
+// set up a pool of nframes frames for another thread to read the
+// files that bp reads; it must be freed before bp is
+
+BufPool forkBufPool(BufPool bp, Count nframes)
+{
+	BufPool fp = newBufPool(nframes, bp->pagesize, bp->pageflags);
+	memcpy(fp->maps, bp->maps, sizeof(bp->maps));
+	fp->nmaps = bp->nmaps;
+	fp->wal = bp->wal;
+	fp->forked = TRUE;
+	return fp;
+}
+
+// write back all dirty frames and release the pool
+
+void freeBufPool(BufPool bp)
+{
+	flushBufPool(bp);
+	for (Count m = 0; m < bp->nmaps && !bp->forked; m++) {
+		Mapping *mp = &bp->maps[m];
+		munmap(mp->base, (size_t)mp->npages*bp->pagesize);
+	}
+	free(bp->hash);
+	free(bp->pages);
+	free(bp->frames);
+	free(bp);
+}
+
+// return a pinned in-memory copy of page pid from file f
+// the page stays resident until it is unpinned
+
+Page pinPage(BufPool bp, FILE *f, PageID pid)
+{
+	assert(f != NULL && pid != NO_PAGE);
+	Mapping *mp = findMapping(bp, f);
+	// the log may hold a newer image than the mapping
+	if (mp != NULL && pid < mp->npages
+	    && (bp->wal == NULL || !walHasPage(bp->wal, f, pid))) {
+		bp->nhits++;
+		return (Page)(mp->base + (size_t)pid*bp->pagesize);
+	}
+	int i = findFrame(bp, f, pid);
+	if (i >= 0) {
+		bp->nhits++;
+	}
+	else {
+		i = grabFrame(bp);
+		Page p = framePage(bp,i);
+		if (bp->wal == NULL || !walReadPage(bp->wal, f, pid, p)) {
+			if (!bp->forked)
+				readPage(f, pid, p, bp->pagesize);
+			else {
+				ssize_t n = pread(fileno(f), p, bp->pagesize,
+				                  (off_t)pid*bp->pagesize);
+				assert(n == bp->pagesize);
+			}
+		}
+		bp->nreads++;
+		Frame *fr = &bp->frames[i];
+		fr->file = f; fr->pid = pid;
+		Count h = hashSlot(bp, f, pid);
+		fr->next = bp->hash[h];
+		bp->hash[h] = i;
+	}
+	bp->frames[i].pin++;
+	bp->frames[i].ref = TRUE;
+	return framePage(bp,i);
+}
+
+// append a new empty page to file f
+// return it pinned, and set *pid to its PageID
+
+Page pinNewPage(BufPool bp, FILE *f, PageID *pid)
+{
+	assert(!bp->forked && findMapping(bp, f) == NULL);
+	*pid = addPage(f, bp->pagesize, bp->pageflags);
+	int i = grabFrame(bp);
+	initPage(framePage(bp,i), bp->pagesize, bp->pageflags);
+	Frame *fr = &bp->frames[i];
+	fr->file = f; fr->pid = *pid;
+	fr->pin = 1; fr->ref = TRUE;
+	Count h = hashSlot(bp, f, *pid);
+	fr->next = bp->hash[h];
+	bp->hash[h] = i;
+	return framePage(bp,i);
+}
+
+// release a page obtained from pinPage/pinNewPage
+// dirty indicates whether the caller modified it
+
+void unpinPage(BufPool bp, Page p, Bool dirty)
+{
+	for (Count m = 0; m < bp->nmaps; m++) {
+		Mapping *mp = &bp->maps[m];
+		char *c = (char *)p;
+		if (c >= mp->base && c < mp->base + (size_t)mp->npages*bp->pagesize) {
+			assert(!dirty);
+			return;
+		}
+	}
+	size_t off = (char *)p - bp->pages;
+	assert(off % bp->pagesize == 0);
+	int i = off / bp->pagesize;
+	assert(0 <= i && i < bp->nframes);
+	Frame *fr = &bp->frames[i];
+	assert(fr->pin > 0);
+	fr->pin--;
+	if (dirty) fr->dirty = TRUE;
+}
+
+// map a file opened read-only into memory
+// subsequent pins of its pages point into the mapping
+// returns FALSE (and leaves the file to the frames) if it can't be mapped
+
+Bool mapFile(BufPool bp, FILE *f)
+{
+	struct stat st;
+	if (bp->nmaps == MAXMAPS || fstat(fileno(f), &st) < 0)
+		return FALSE;
+	Count npages = st.st_size/bp->pagesize;
+	if (npages == 0) return FALSE;
+	void *base = mmap(NULL, (size_t)npages*bp->pagesize, PROT_READ,
+	                  MAP_SHARED, fileno(f), 0);
+	if (base == MAP_FAILED) return FALSE;
+	Mapping *mp = &bp->maps[bp->nmaps++];
+	mp->file = f;
+	mp->base = base;
+	mp->npages = npages;
+	return TRUE;
+}
+
+// send pages written from now on to log w (NULL = back to files)
+
+void useWal(BufPool bp, Wal w)
+{
+	bp->wal = w;
+}
+
+// hint that page pid of file f will be pinned soon
+// starts asynchronous readahead; doesn't use a frame
+
+void prefetchPage(BufPool bp, FILE *f, PageID pid)
+{
+	Mapping *mp = findMapping(bp, f);
+	if (mp != NULL && pid < mp->npages) {
+		posix_madvise(mp->base + (size_t)pid*bp->pagesize, bp->pagesize,
+		              POSIX_MADV_WILLNEED);
+		return;
+	}
+	if (findFrame(bp, f, pid) >= 0) return;
+	posix_fadvise(fileno(f), (off_t)pid*bp->pagesize, bp->pagesize,
+	              POSIX_FADV_WILLNEED);
+	bp->nprefetch++;
+}
+
+// write all dirty frames back to their files (or the log)
+// pages go out in file order, so writes to a file are sequential
+
+void flushBufPool(BufPool bp)
+{
+	FrameKey dirty[bp->nframes];
+	Count ndirty = 0;
+	for (Count i = 0; i < bp->nframes; i++) {
+		Frame *fr = &bp->frames[i];
+		if (!fr->dirty) continue;
+		dirty[ndirty].file = fr->file;
+		dirty[ndirty].pid = fr->pid;
+		dirty[ndirty].frame = i;
+		ndirty++;
+	}
+	qsort(dirty, ndirty, sizeof(FrameKey), cmpFrame);
+	for (Count i = 0; i < ndirty; i++) writeFrame(bp, dirty[i].frame);
+}
+
+// write all dirty frames back and empty the pool
+// (for when the pages in its files are about to be replaced)
+
+void clearBufPool(BufPool bp)
+{
+	flushBufPool(bp);
+	for (Count i = 0; i < bp->nframes; i++) {
+		Frame *fr = &bp->frames[i];
+		assert(fr->pin == 0);
+		if (fr->file != NULL) dropFrame(bp, i);
+	}
+}
+
+// displays pool activity counters (for debugging)
+
+void bufPoolStats(BufPool bp)
+{
+	printf("Buffer pool: %d frames of %d bytes, %d hits, %d reads, %d writes, "
+	       "%d prefetches\n", bp->nframes, bp->pagesize, bp->nhits,
+	       bp->nreads, bp->nwrites, bp->nprefetch);
+	if (bp->wal != NULL) walStats(bp->wal);
+}
+
+// hash table slot for a (file,page) pair
+
+static Count hashSlot(BufPool bp, FILE *f, PageID pid)
+{
+	size_t key = (size_t)f ^ ((size_t)pid * 2654435761u);
+	return (key ^ (key >> 16)) & (bp->nhash-1);
+}
+
+// mapping for file f, or NULL if f is not mapped
+
+static Mapping *findMapping(BufPool bp, FILE *f)
+{
+	for (Count m = 0; m < bp->nmaps; m++) {
+		if (bp->maps[m].file == f) return &bp->maps[m];
+	}
+	return NULL;
+}
+
+// frame holding (f,pid), or -1 if not resident
+
+static int findFrame(BufPool bp, FILE *f, PageID pid)
+{
+	int i = bp->hash[hashSlot(bp, f, pid)];
+	while (i >= 0) {
+		Frame *fr = &bp->frames[i];
+		if (fr->file == f && fr->pid == pid) return i;
+		i = fr->next;
+	}
+	return -1;
+}
+
+// find a frame to (re)use, evicting its current page if needed
+// sweeps the clock hand, giving referenced frames a second chance
+
+static int grabFrame(BufPool bp)
+{
+	// two full sweeps clear every ref bit;
+	// if nothing is free after that, all frames are pinned
+	for (Count n = 0; n < 2*bp->nframes; n++) {
+		int i = bp->clock;
+		bp->clock = (bp->clock + 1) % bp->nframes;
+		Frame *fr = &bp->frames[i];
+		if (fr->pin > 0) continue;
+		if (fr->file != NULL && fr->ref) {
+			fr->ref = FALSE;
+			continue;
+		}
+		if (fr->file != NULL) {
+			if (fr->dirty) writeFrame(bp, i);
+			dropFrame(bp, i);
+		}
+		return i;
+	}
+	fatal("Buffer pool: all frames are pinned");
+	return -1;
+}
+
+// remove frame i from its hash chain
+
+static void dropFrame(BufPool bp, int i)
+{
+	Frame *fr = &bp->frames[i];
+	int *link = &bp->hash[hashSlot(bp, fr->file, fr->pid)];
+	while (*link != i) {
+		assert(*link >= 0);
+		link = &bp->frames[*link].next;
+	}
+	*link = fr->next;
+	fr->file = NULL; fr->pid = NO_PAGE;
+	fr->next = -1; fr->ref = FALSE;
+}
+
+// write back the page in frame i
+
+static void writeFrame(BufPool bp, int i)
+{
+	Frame *fr = &bp->frames[i];
+	if (bp->wal != NULL)
+		walLogPage(bp->wal, fr->file, fr->pid, framePage(bp,i));
+	else
+		writePage(fr->file, fr->pid, framePage(bp,i), bp->pagesize);
+	fr->dirty = FALSE;
+	bp->nwrites++;
+}
+
+// order frames by file, then page
+
+static int cmpFrame(const void *a, const void *b)
+{
+	const FrameKey *x = a, *y = b;
+	if (x->file != y->file)
+		return ((size_t)x->file > (size_t)y->file) - ((size_t)x->file < (size_t)y->file);
+	return (x->pid > y->pid) - (x->pid < y->pid);
+}
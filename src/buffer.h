@@ -0,0 +1,26 @@
+// buffer.h ... interface to the shared buffer pool
+// See buffer.c for details of BufPool type and functions
+
+#ifndef BUFFER_H
+#define BUFFER_H 1
+
+typedef struct BufPoolRep *BufPool;
+
+#include "defs.h"
+#include "page.h"
+#include "wal.h"
+
+BufPool newBufPool(Count nframes, Count pagesize, Count pageflags);
+BufPool forkBufPool(BufPool bp, Count nframes);
+void freeBufPool(BufPool bp);
+Page pinPage(BufPool bp, FILE *f, PageID pid);
+Page pinNewPage(BufPool bp, FILE *f, PageID *pid);
+void unpinPage(BufPool bp, Page p, Bool dirty);
+Bool mapFile(BufPool bp, FILE *f);
+void useWal(BufPool bp, Wal w);
+void prefetchPage(BufPool bp, FILE *f, PageID pid);
+void flushBufPool(BufPool bp);
+void clearBufPool(BufPool bp);
+void bufPoolStats(BufPool bp);
+
+#endif
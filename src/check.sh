@@ -0,0 +1,673 @@
+#!/bin/bash
+# Usage: ./check.sh
+# regression checks for the programs in this directory (run by make check)
+# each check builds relations in a scratch directory and compares what
+# query finds in them with what they should hold
+# every check runs on plain, compressed (-z) and hashed (-H) relations
+
+B=$(cd "$(dirname "$0")" && pwd)
+T=$(mktemp -d)
+trap 'rm -rf "$T"' EXIT
+cd "$T" || exit 1
+CV="0,0:1,0:2,0:0,1:1,1:2,1:0,2:1,2:2,2"
+nfail=0
+
+# make relation $1 with create's options $2, holding the tuples in file $3
+load()
+{
+	rm -f $1.*
+	"$B"/create $2 $1 3 1 "$CV" >/dev/null || return 1
+	"$B"/insert $1 <$3 >/dev/null
+}
+
+# every tuple of relation $1, sorted
+scan() { "$B"/query '*' from $1 where '?,?,?' | sort; }
+
+# field $2 of stats for relation $1 (e.g. "#pages")
+stat() { "$B"/stats $1 | grep -o "$2:[0-9-]*" | cut -d: -f2; }
+
+# wait for log $1 (and any other files named) to stop growing, as a
+# writer waits for input; fails if they are empty
+logged()
+{
+	local s=-1
+	while [ "$s" != "$(cat "$@" | wc -c)" ]; do
+		s=$(cat "$@" | wc -c)
+		sleep 0.2
+	done
+	[ "$s" -gt 0 ]
+}
+
+# $1 tuples of about 190 bytes, numbered from $2; on 4K pages, the
+# first block insert reads takes a few log commits and no checkpoint
+wide()
+{
+	awk -v n=$1 -v k=$2 'BEGIN {
+		s = sprintf("%180s", ""); gsub(/ /, "x", s)
+		for (i = k; i < k+n; i++) print i "," s "," i%97
+	}'
+}
+
+# the little-endian words $@
+words()
+{
+	for w; do
+		printf "$(printf '\\x%02x' $((w&255)) $((w>>8&255)) \
+			$((w>>16&255)) $((w>>24&255)))"
+	done
+}
+
+# make relation $1 holding the tuples in file $2 as the programs did
+# before slotted pages: one bucket (depth 0) whose 1K pages hold
+# their header words (free offset, ovflow page, #tuples) and then
+# '\0'-terminated tuples, and a .info of five words and the cv
+legacy()
+{
+	rm -f $1.* pg.*
+	awk '{ n = length($0) + 1; if (used + n > 1012) { p++; used = 0 }
+		used += n; print > ("pg." p+0) }' $2
+	local np=$(ls pg.* | wc -l) i
+	: >$1.data
+	: >$1.ovflow
+	for ((i = 0; i < np; i++)); do
+		local f=$1.ovflow next=$i
+		[ $i = 0 ] && f=$1.data
+		[ $((i+1)) = $np ] && next=4294967295
+		{
+			words $(wc -c <pg.$i) $next $(wc -l <pg.$i)
+			tr '\n' '\0' <pg.$i
+			head -c $((1012 - $(wc -c <pg.$i))) /dev/zero
+		} >>$f
+	done
+	{
+		words 3 0 0 1 $(wc -l <$2)
+		for ((i = 0; i < 32; i++)); do
+			printf "$(printf '\\x%02x\\x%02x' $((i%3)) $((i/3)))"
+		done
+	} >$1.info
+	rm -f pg.*
+}
+
+# build the programs again in small/ with the sizes in defs.h made
+# small enough that the checks run out of them (once per run)
+SMALL="-DBUFBYTES=16384 -DWALCHECKPOINT=64 -DBULKMEM=65536 \
+	-DREADBUF=1000"
+small()
+{
+	[ -x small/query ] && return
+	mkdir -p small && cp "$B"/*.[ch] "$B"/Makefile small &&
+		make -s -C small CPPFLAGS="$SMALL" >/dev/null
+}
+
+# run check $1 (a function) on each kind of relation
+run()
+{
+	for opt in "" -z -H; do
+		if $1 "$opt"; then
+			echo "ok   $1 $opt"
+		else
+			echo "FAIL $1 $opt"
+			nfail=$((nfail+1))
+		fi
+	done
+}
+
+# run check $1 (a function) once
+once()
+{
+	if $1; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1"
+		nfail=$((nfail+1))
+	fi
+}
+
+# delete and update, where updated tuples move to other buckets
+delete_update()
+{
+	"$B"/gendata 3000 3 >in
+	load R "$1" in || return 1
+	"$B"/delete from R where '%1,?,?' || return 1
+	grep -v '^[0-9]*1,' in | sort >want
+	scan R | cmp -s - want || return 1
+	"$B"/update R set '?,changed,?' where '%2,?,?' || return 1
+	awk -F, -v OFS=, '$1 ~ /2$/ { $2 = "changed" } 1' want | sort >want2
+	scan R | cmp -s - want2 || return 1
+	[ "$(stat R '#tuples')" = "$(wc -l <want2)" ]
+}
+
+# deleting every tuple merges the file back to one page, and it
+# grows again when the tuples are inserted again
+delete_all()
+{
+	"$B"/gendata 3000 3 >in
+	load R "$1" in || return 1
+	"$B"/delete from R where '?,?,?' || return 1
+	[ "$(stat R '#pages')" = 1 ] && [ -z "$(scan R)" ] || return 1
+	"$B"/insert R <in >/dev/null || return 1
+	sort in | cmp -s - <(scan R)
+}
+
+# a relation presized by create -n keeps its pages when emptied
+presized()
+{
+	rm -f R.*
+	"$B"/create $1 -n 5000 R 3 1 "$CV" >/dev/null || return 1
+	local np=$(stat R '#pages')
+	"$B"/gendata 2000 3 | "$B"/insert R >/dev/null || return 1
+	"$B"/delete from R where '?,?,?' || return 1
+	[ "$(stat R '#pages')" = "$np" ] && [ "$np" -gt 1 ]
+}
+
+# deletes along one long chain free its overflow pages
+long_chain()
+{
+	awk 'BEGIN { for (i = 0; i < 3000; i++) print i ",same,v" i%7 }' >in
+	rm -f R.*
+	"$B"/create $1 R 3 1 "1,0:1,1:1,2:1,3" >/dev/null || return 1
+	"$B"/insert R <in >/dev/null || return 1
+	"$B"/delete from R where '%1,?,?' || return 1
+	"$B"/delete from R where '%3,?,?' || return 1
+	[ "$(stat R '#free ovflow pages')" -gt 0 ] || return 1
+	grep -v '^[0-9]*[13],' in | sort | cmp -s - <(scan R)
+}
+
+# with a 16-page pool, updates evict dirty pages as they go, and
+# delete, update and scan keep every tuple as with a full-sized pool
+small_pool()
+{
+	small || return 1
+	local B="$T"/small
+	delete_update "$1" && delete_all "$1"
+}
+
+# insert -b builds what inserting the tuples one at a time does:
+# the same buckets, holding the same tuples in the same order, both
+# when they fit in memory and when the small build (64K of BULKMEM)
+# spills them and sorts them in runs
+bulk_load()
+{
+	small || return 1
+	"$B"/gendata 5000 3 >in
+	load R "$1" in || return 1
+	"$B"/query '*' from R where '?,?,?' >want
+	local shape="$(stat R '#pages') $(stat R sp) $(stat R '#tuples')"
+	for p in "$B" small; do
+		rm -f R.*
+		"$B"/create $1 R 3 1 "$CV" >/dev/null || return 1
+		$p/insert -b R <in >/dev/null || return 1
+		[ ! -f R.load ] || return 1
+		[ "$(stat R '#pages') $(stat R sp) $(stat R '#tuples')" = \
+			"$shape" ] || return 1
+		"$B"/query '*' from R where '?,?,?' | cmp -s - want || return 1
+	done
+}
+
+# insert -j places tuples in the order they were read, so whatever
+# the number of hashers it builds what a serial insert does
+insert_threads()
+{
+	"$B"/gendata 5000 3 >in
+	load R "$1" in || return 1
+	"$B"/query '*' from R where '?,?,?' >want
+	for j in 1 3 8; do
+		rm -f R.*
+		"$B"/create $1 R 3 1 "$CV" >/dev/null || return 1
+		"$B"/insert -j $j R <in >/dev/null || return 1
+		"$B"/query '*' from R where '?,?,?' | cmp -s - want || return 1
+	done
+}
+
+# an insert killed part way through leaves the relation holding the
+# tuples of its last commit, which are the first so many thousand
+# (WALBATCH) of its input, and the next insert carries on from there
+# (in the small build, a 4-page pool writes uncommitted pages to the
+# log between commits, and checkpoints come every 64 pages)
+wal_recovery()
+{
+	small || return 1
+	wide 5600 0 >in
+	wide 500 100000 >more
+	for p in "$B" small; do
+		rm -f R.* feed
+		$p/create $1 R 3 1 "$CV" 4096 >/dev/null || return 1
+		mkfifo feed
+		$p/insert R <feed >/dev/null &
+		local ins=$!
+		exec 3>feed
+		cat in >&3
+		logged R.wal R.data
+		local ok=$?
+		kill -9 $ins
+		exec 3>&-
+		wait $ins 2>/dev/null
+		[ $ok = 0 ] || return 1
+		local n=$(scan R | wc -l)
+		[ $n -gt 0 ] && [ $((n % 1000)) = 0 ] || return 1
+		head -n $n in | sort | cmp -s - <(scan R) || return 1
+		$p/insert R <more >/dev/null || return 1
+		[ "$(wc -c <R.wal)" = 0 ] || return 1
+		head -n $n in | sort - more | cmp -s - <(scan R) || return 1
+	done
+}
+
+# a mapped query with a 4-page pool reads the pages an interrupted
+# insert left in the log through its frames, and finds what a query
+# with a full-sized pool does, and the relation holds after recovery
+small_reader()
+{
+	small || return 1
+	wide 3000 0 >in
+	wide 6000 100000 >more
+	rm -f R.* feed
+	"$B"/create $1 R 3 1 "$CV" 4096 >/dev/null || return 1
+	"$B"/insert R <in >/dev/null || return 1
+	mkfifo feed
+	"$B"/insert R <feed >/dev/null &
+	local ins=$!
+	exec 3>feed
+	cat more >&3
+	logged R.wal
+	local ok=$?
+	kill -9 $ins
+	exec 3>&-
+	wait $ins 2>/dev/null
+	[ $ok = 0 ] || return 1
+	for q in '?,?,?' '1%,?,?' '?,?,5'; do
+		"$B"/query '*' from R where "$q" >want
+		small/query '*' from R where "$q" | cmp -s - want || return 1
+		small/query -j 3 '*' from R where "$q" | cmp -s - want ||
+			return 1
+	done
+	"$B"/query '*' from R where '?,?,?' | sort >before
+	# some of more was committed, and all of in
+	[ "$(wc -l <before)" -gt 3000 ] || return 1
+	sort in | comm -13 before - | cmp -s - /dev/null || return 1
+	"$B"/insert R </dev/null >/dev/null || return 1
+	cmp -s before <(scan R)
+}
+
+# each page size create accepts holds the same tuples in pages of
+# that size, and sizes that aren't powers of 2 from 1K to 64K are
+# refused
+page_sizes()
+{
+	"$B"/gendata 3000 3 >in
+	grep -v '^[0-9]*1,' in | sort >want
+	for ps in 1024 4096 8192 65536; do
+		rm -f R.*
+		"$B"/create $1 R 3 1 "$CV" $ps >/dev/null || return 1
+		"$B"/insert R <in >/dev/null || return 1
+		[ "$(stat R pagesize)" = $ps ] || return 1
+		[ $(($(wc -c <R.data) % ps)) = 0 ] || return 1
+		[ $(($(wc -c <R.data) / ps)) -ge "$(stat R '#pages')" ] ||
+			return 1
+		sort in | cmp -s - <(scan R) || return 1
+		"$B"/delete from R where '%1,?,?' || return 1
+		cmp -s want <(scan R) || return 1
+	done
+	for ps in 512 1000 131072; do
+		rm -f R.*
+		"$B"/create $1 R 3 1 "$CV" $ps >/dev/null 2>&1 && return 1
+	done
+	return 0
+}
+
+# insert takes lines of up to MAXTUPLEN-1 (199) chars, and a last
+# line with no newline, and stops at the first line that is longer;
+# lines split across input blocks (1000 bytes in the small build)
+# are put back together
+long_lines()
+{
+	small || return 1
+	local x=$(printf '%195s' '' | tr ' ' x)
+	{ "$B"/gendata 10 3; echo "1,$x,z"; printf 'last,no,newline'; } >in
+	rm -f R.*
+	"$B"/create R 3 1 "$CV" >/dev/null || return 1
+	"$B"/insert R <in >/dev/null || return 1
+	{ cat in; echo; } | sort | cmp -s - <(scan R) || return 1
+	{ "$B"/gendata 10 3; echo "1,${x}x,z"; } >in
+	for p in "$B" small; do
+		rm -f R.*
+		"$B"/create R 3 1 "$CV" >/dev/null || return 1
+		$p/insert R <in >/dev/null 2>err && return 1
+		grep -q 'Line 11 is longer than 199' err || return 1
+	done
+	{ "$B"/gendata 3000 3; wide 500 0; "$B"/gendata 3000 3 5000; } >in
+	load R "" in || return 1
+	"$B"/query '*' from R where '?,?,?' >want
+	for opt in "" "-j 3"; do
+		rm -f R.*
+		"$B"/create R 3 1 "$CV" >/dev/null || return 1
+		small/insert $opt R <in >/dev/null || return 1
+		"$B"/query '*' from R where '?,?,?' | cmp -s - want || return 1
+	done
+}
+
+# a relation in the old page format can be read but not written,
+# and upgrade rewrites it so that it can
+upgrade_legacy()
+{
+	"$B"/gendata 300 3 >in
+	legacy R in
+	[ "$(stat R '#pages')" = 1 ] || return 1
+	sort in | cmp -s - <(scan R) || return 1
+	"$B"/query '*' from R where '1%,?,?' | sort >got
+	grep '^1' in | sort | cmp -s - got || return 1
+	"$B"/gendata 300 3 1000 >more
+	"$B"/insert R <more >/dev/null 2>&1 && return 1
+	"$B"/upgrade R || return 1
+	sort in | cmp -s - <(scan R) || return 1
+	"$B"/insert R <more >/dev/null || return 1
+	[ "$(stat R '#pages')" -gt 1 ] || return 1
+	"$B"/upgrade R | grep -q 'already' || return 1
+	sort in more | cmp -s - <(scan R)
+}
+
+# after a few thousand splits each tuple is in the bucket its hash
+# says: a lookup on any of its values finds it, and rehashing every
+# tuple (reorg under the same choice vector) changes nothing
+split_routing()
+{
+	"$B"/gendata 5000 3 >in
+	load R "$1" in || return 1
+	"$B"/query '*' from R where '?,?,?' >want
+	awk 'NR % 97 == 0' in | while IFS=, read a b c; do
+		for q in "$a,?,?" "?,$b,?" "?,?,$c" "$a,$b,$c"; do
+			"$B"/query '*' from R where "$q" | grep -qxF "$a,$b,$c" ||
+				exit 1
+		done
+	done || return 1
+	"$B"/reorg R "$CV" >/dev/null || return 1
+	"$B"/query '*' from R where '?,?,?' | cmp -s - want
+}
+
+# tuples that carry their hash (-H) are split, updated and looked up
+# by it, and are found as tuples without one are (their records are
+# longer, so the file splits at other times and scans in another
+# order)
+stored_hash()
+{
+	"$B"/gendata 5000 3 >in
+	load P "" in || return 1
+	"$B"/update P set '?,changed,?' where '%2,?,?' || return 1
+	for opt in -H "-z -H"; do
+		load R "$opt" in || return 1
+		"$B"/update R set '?,changed,?' where '%2,?,?' || return 1
+		for q in '?,?,?' '?,changed,?' '12,?,?' '?,?,desk'; do
+			"$B"/query '*' from P where "$q" | sort >want
+			"$B"/query '*' from R where "$q" | sort | cmp -s - want ||
+				return 1
+		done
+	done
+}
+
+# reorg moves every tuple into the next generation's files
+reorg_swap()
+{
+	"$B"/gendata 3000 3 >in
+	load R "$1" in || return 1
+	"$B"/reorg R "2,0:1,0:0,0:2,1:1,1:0,1" >/dev/null || return 1
+	[ -f R.data.1 ] && [ -f R.ovflow.1 ] && [ ! -f R.data ] &&
+		[ ! -f R.wal ] || return 1
+	sort in | cmp -s - <(scan R) || return 1
+	"$B"/gendata 500 3 5000 | tee -a in | "$B"/insert R >/dev/null
+	sort in | cmp -s - <(scan R)
+}
+
+# inserts that run while reorg swaps generations wait for it, and
+# are all kept (as is every reorg, which waits for them)
+reorg_writer()
+{
+	"$B"/gendata 1000 3 >in
+	load R "$1" in || return 1
+	rm -f done failed
+	(
+		for i in 0 1 2 3 4 5; do
+			cv=$([ $((i%2)) = 0 ] && echo "1,0:2,0:0,0" || echo "$CV")
+			"$B"/reorg R "$cv" >/dev/null || touch failed
+		done
+		touch done
+	) &
+	j=0
+	while [ ! -f done ]; do
+		j=$((j+1))
+		"$B"/gendata 5 3 $((10000+5*j)) >more
+		"$B"/insert R <more >/dev/null || touch failed
+		cat more >>in
+	done
+	wait
+	[ ! -f failed ] && [ $j -gt 1 ] && sort in | cmp -s - <(scan R)
+}
+
+# vacuum drops the free list and keeps every tuple
+vacuum_gen()
+{
+	"$B"/gendata 3000 3 >in
+	load R "$1" in || return 1
+	for d in 1 3 5 7 9; do
+		"$B"/delete from R where "%$d,?,?" || return 1
+	done
+	grep '^[0-9]*[02468],' in | sort >want
+	[ "$(stat R '#free ovflow pages')" -gt 0 ] || return 1
+	"$B"/vacuum R || return 1
+	[ -f R.data.1 ] && [ "$(stat R '#free ovflow pages')" = 0 ] || return 1
+	cmp -s want <(scan R)
+}
+
+# advise's choice vector is one create and reorg accept, and reorg
+# under it keeps every tuple; over-long selections are refused
+advise_cv()
+{
+	"$B"/gendata 3000 3 >in
+	load R "$1" in || return 1
+	printf '%s\n' '# lookups by id' '10,?,?' '2%,?,?' '?,?,desk' >log
+	local cv=$("$B"/advise R log | awk '$1 == "advised:" { print $4 }')
+	[ -n "$cv" ] || return 1
+	"$B"/advise R log in | grep -q '^advised:' || return 1
+	# selections of up to 199 chars, as insert takes tuples
+	local x=$(printf '%195s' '' | tr ' ' x)
+	echo "?,?,$x" >>log
+	"$B"/advise R log | grep -q '^advised:' || return 1
+	echo "?,?,x$x" >>log
+	"$B"/advise R log >/dev/null 2>err && return 1
+	grep -q 'Line 6 of query log is longer than 199' err || return 1
+	"$B"/reorg R "$cv" >/dev/null || return 1
+	sort in | cmp -s - <(scan R)
+}
+
+# tuples whose values, from empty to $2 chars, are made of few
+# letters, so that patterns over them match some but not all
+likely()
+{
+	awk -v n=$1 -v m=$2 'BEGIN {
+		srand(11)
+		for (i = 0; i < n; i++) {
+			a = ""; b = ""
+			k = int(rand() * (m+1))
+			for (j = 0; j < k; j++) a = a substr("abcqxz", 1+int(rand()*6), 1)
+			k = int(rand() * 4)
+			for (j = 0; j < k; j++) b = b substr("ab", 1+int(rand()*2), 1)
+			print i "," a "," b
+		}
+	}'
+}
+
+# of the tuples in file $1, those matching pattern $2, where '?'
+# matches any value and '%' any run of chars, as patternMatch does
+like()
+{
+	awk -F, -v q="$2" '
+	function re(p) { gsub(/%+/, ".*", p); return "^" p "$" }
+	BEGIN { n = split(q, p, ",") }
+	{
+		for (i = 1; i <= n; i++)
+			if (p[i] != "?" && $i !~ re(p[i])) next
+		print
+	}' $1
+}
+
+# query finds what patternMatch would for exact values, prefixes,
+# suffixes, infixes and other patterns, including empty values and
+# values of nothing but '%'; the literals markRegion looks for across
+# a page's records fall at every place in its 32-byte blocks, on pages
+# of up to 64K and in values of up to 60 chars
+like_patterns()
+{
+	for size in "1024 12" "4096 40" "65536 60"; do
+		set -- "$1" $size
+		likely 3000 $3 >in
+		rm -f R.*
+		"$B"/create $1 R 3 1 "$CV" $2 >/dev/null || return 1
+		"$B"/insert R <in >/dev/null || return 1
+		for q in '?,,?' '?,%,?' '?,%%,?' '?,?,' '?,a,?' '?,ab%,?' \
+		         '?,%ab,?' '?,%ab%,?' '?,%zq%,?' '?,a%b,?' '?,%a%b%,?' \
+		         '?,q%z%,a' '?,x%%y,?' '?,%zq%x%,b%' '?,%%q%%,%b' \
+		         '1%,%c%,?' '%7,?,ab' '?,abcqxzabc%,?' '?,%,' '12,,%' \
+		         '?,%qxzab%,?' '?,%zzz%,?' '?,%cqcq%,b'; do
+			"$B"/query '*' from R where "$q" | sort >got
+			like in "$q" | sort | cmp -s - got || return 1
+		done
+	done
+}
+
+# query -j prints what a serial scan does, in the same order, and
+# -u prints the same tuples in any order
+query_threads()
+{
+	"$B"/gendata 5000 3 >in
+	load R "$1" in || return 1
+	for q in '?,?,?' '%7,?,?' '?,%an%,?' '123,?,?' '?,comet,%'; do
+		"$B"/query '*' from R where "$q" >serial
+		"$B"/query -j 3 '*' from R where "$q" | cmp -s - serial || return 1
+		"$B"/query -j 8 '3,1' from R where "$q" >proj
+		"$B"/query '3,1' from R where "$q" | cmp -s - proj || return 1
+		sort serial >want
+		"$B"/query -j 3 -u '*' from R where "$q" | sort | cmp -s - want ||
+			return 1
+	done
+}
+
+# a query that indexed the log before a writer's checkpoint emptied
+# it reads those pages from the files instead, and finishes
+log_reader()
+{
+	wide 6000 0 >in
+	wide 1000 100000 >more
+	rm -f R.* feed done
+	"$B"/create $1 R 3 1 "$CV" 4096 >/dev/null || return 1
+	mkfifo feed
+	"$B"/insert R <feed >/dev/null &
+	local ins=$! ok=0
+	exec 3>feed
+	# a full input block is inserted and committed, not checkpointed
+	cat in >&3
+	logged R.wal || ok=1
+	# the query stalls on its output until the insert has finished
+	("$B"/query '*' from R where '?,?,?' || echo failed) 3>&- |
+		(while [ ! -f done ]; do sleep 0.1; done; cat) 3>&- >got &
+	local q=$!
+	sleep 0.3
+	cat more >&3
+	exec 3>&-
+	wait $ins || ok=1
+	touch done
+	wait $q
+	[ $ok = 0 ] && [ "$(wc -c <R.wal)" = 0 ] || return 1
+	# splits since the query began can hide tuples from it or show
+	# them twice, but it sees nothing that wasn't inserted
+	sort -u got | comm -23 - <(sort in more) | cmp -s - /dev/null
+}
+
+# a query that began before a reorg finishes on the old generation's
+# files and log, while a writer fills the new generation's log
+reorg_reader()
+{
+	wide 6000 0 >in
+	wide 6000 100000 >more
+	rm -f R.* feed done
+	"$B"/create $1 R 3 1 "$CV" 4096 >/dev/null || return 1
+	mkfifo feed
+	# leave committed pages in the log, as an interrupted insert does
+	"$B"/insert R <feed >/dev/null &
+	local ins=$!
+	exec 3>feed
+	cat in >&3
+	logged R.wal
+	local ok=$?
+	kill -9 $ins
+	exec 3>&-
+	wait $ins 2>/dev/null
+	[ $ok = 0 ] || return 1
+	("$B"/query '*' from R where '?,?,?' || echo failed) 3>&- |
+		(while [ ! -f done ]; do sleep 0.1; done; cat) 3>&- >got &
+	local q=$!
+	sleep 0.3
+	# (the query and insert are let go whatever happens)
+	"$B"/reorg R "2,0:1,0:0,0:2,1:1,1:0,1" >/dev/null || ok=1
+	scan R >before
+	"$B"/insert R <feed >/dev/null &
+	ins=$!
+	exec 3>feed
+	cat more >&3
+	logged R.wal.1 || ok=1
+	touch done
+	wait $q
+	exec 3>&-
+	wait $ins || ok=1
+	[ $ok = 0 ] && sort got | cmp -s - before || return 1
+	sort before more | cmp -s - <(scan R)
+}
+
+# hashBatch gives what each function gives one key at a time, at
+# every register width, for keys of every length either function
+# treats differently (0-3, the 12-byte blocks of jenkins, 16 bytes
+# and the 48-byte rounds of wyhash) in whole batches and mixed
+hash_lanes()
+{
+	awk 'BEGIN {
+		srand(7)
+		split("0 1 2 3 4 5 7 8 11 12 13 15 16 17 24 25 47 48 49 100 190", len)
+		for (i = 0; i < 21*32 + 3000; i++) {
+			n = (i < 21*32) ? len[int(i/32) + 1] : len[int(rand()*21) + 1]
+			s = ""
+			while (length(s) < n)
+				s = s sprintf("%c", 97 + int(rand()*26))
+			print s
+		}
+	}' >keys
+	for w in 512 256 0; do
+		"$B"/hashbench -r 1 -w $w <keys >/dev/null || return 1
+	done
+}
+
+once hash_lanes
+once upgrade_legacy
+once long_lines
+run delete_update
+run page_sizes
+run delete_all
+run split_routing
+run small_pool
+once stored_hash
+run small_reader
+run bulk_load
+run insert_threads
+run wal_recovery
+run presized
+run long_chain
+run reorg_swap
+run reorg_writer
+run vacuum_gen
+run advise_cv
+run like_patterns
+run query_threads
+run log_reader
+run reorg_reader
+
+if [ $nfail -gt 0 ]; then
+	echo "$nfail checks failed"
+	exit 1
+fi
+echo "all checks passed"
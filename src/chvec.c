@@ -41,19 +41,26 @@ Status parseChVec(Reln r, char *str, ChVec cv)
 		printf("cv[%d] is (%d,%d)\n", i, cv[i].att, cv[i].bit);
 		i++;
 	}
-	// get enough bits for a 32-bit choice vector
-	// take new bits from top end of each hash,
-	//   so as to hopefully not conflict 
+	fillChVec(cv, i, nattr);
+	for (; i < MAXCHVEC; i++)
+		printf("cv[%d] is (%d,%d)\n", i, cv[i].att, cv[i].bit);
+	return OK;
+}
+
+// get enough bits for a 32-bit choice vector, given cv[0..n-1]
+// take new bits from top end of each hash,
+//   so as to hopefully not conflict 
+
+void fillChVec(ChVec cv, Count n, Count nattrs)
+{
 	Count x;  Count next[MAXCHVEC];
 	for (x = 0; x < MAXCHVEC; x++) next[x] = 31;
 	x = 0;
-	while (i < MAXCHVEC) {
-		cv[i].att = x; cv[i].bit = next[x];
-		printf("cv[%d] is (%d,%d)\n", i, cv[i].att, cv[i].bit);
+	while (n < MAXCHVEC) {
+		cv[n].att = x; cv[n].bit = next[x];
 		next[x]--;
-		i++; x = (x+1) % nattr;
+		n++; x = (x+1) % nattrs;
 	}
-	return OK;
 }
 
 // print a choice vector (for debugging)
@@ -67,3 +74,106 @@ void printChVec(ChVec cv)
 	}
 	printf("\n");
 }
+
+// A HashPlan does the work of the choice vector once per relation
+// - refs lists the attributes the vector uses, so a tuple's other
+//   attributes need not be hashed at all
+// - each attribute's items, in choice vector order, are cut into runs
+//   whose hash bits rise (or fall) steadily; a run's bits can then be
+//   moved together, with PEXT gathering them from the attribute's hash
+//   and PDEP scattering them into the tuple hash (a falling run has
+//   its gathered bits reversed first)
+// - on CPUs without BMI2 the plan falls back to moving the 32 bits
+//   one at a time
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_BMI2 1
+#include <immintrin.h>
+#endif
+
+// reverse the low n bits of v
+
+static Bits reverseBits(Bits v, Count n)
+{
+	v = ((v >> 1) & 0x55555555) | ((v & 0x55555555) << 1);
+	v = ((v >> 2) & 0x33333333) | ((v & 0x33333333) << 2);
+	v = ((v >> 4) & 0x0f0f0f0f) | ((v & 0x0f0f0f0f) << 4);
+	v = ((v >> 8) & 0x00ff00ff) | ((v & 0x00ff00ff) << 8);
+	v = (v >> 16) | (v << 16);
+	return v >> (32 - n);
+}
+
+void compileHashPlan(ChVec cv, HashFunc hash, HashPlan *p)
+{
+	Count i, a;
+	memcpy(p->cv, cv, sizeof(ChVec));
+	p->hash = hash;
+	p->nrefs = 0; p->nsteps = 0;
+	for (a = 0; a < 256; a++) {
+		HashStep *s = NULL;
+		int last = -1, dir = 0;
+		for (i = 0; i < MAXCHVEC; i++) {
+			if (cv[i].att != a) continue;
+			int b = cv[i].bit;
+			// does bit b carry on the current run?
+			int d = (b > last) ? 1 : -1;
+			if (s == NULL || b == last || (dir != 0 && d != dir)) {
+				s = &p->step[p->nsteps++];
+				s->att = a; s->nbits = 0; s->src = 0; s->dst = 0;
+				dir = 0;
+			}
+			else
+				dir = d;
+			s->src |= (Bits)1 << b;
+			s->dst |= (Bits)1 << i;
+			s->rev = (dir < 0);
+			s->nbits++;
+			last = b;
+		}
+		if (s != NULL) p->refs[p->nrefs++] = a;
+	}
+#ifdef HAVE_BMI2
+	p->bmi2 = __builtin_cpu_supports("bmi2") ? TRUE : FALSE;
+#else
+	p->bmi2 = FALSE;
+#endif
+}
+
+#ifdef HAVE_BMI2
+__attribute__((target("bmi2")))
+static Bits gatherBits(HashPlan *p, Bits *attHash)
+{
+	Bits h = 0;
+	for (Count i = 0; i < p->nsteps; i++) {
+		HashStep *s = &p->step[i];
+		Bits v = _pext_u32(attHash[s->att], s->src);
+		if (s->rev) v = reverseBits(v, s->nbits);
+		h |= _pdep_u32(v, s->dst);
+	}
+	return h;
+}
+#endif
+
+// combine per-attribute hashes into a tuple hash
+// attHash[a] only needs to be set for the attributes in p->refs
+
+Bits planHash(HashPlan *p, Bits *attHash)
+{
+#ifdef HAVE_BMI2
+	if (p->bmi2) return gatherBits(p, attHash);
+#endif
+	Bits h = 0;
+	for (Count i = 0; i < MAXCHVEC; i++)
+		h |= ((attHash[p->cv[i].att] >> p->cv[i].bit) & 1) << i;
+	return h;
+}
+
+// bits of the tuple hash that come from attribute att
+
+Bits planMask(HashPlan *p, Count att)
+{
+	Bits m = 0;
+	for (Count i = 0; i < p->nsteps; i++)
+		if (p->step[i].att == att) m |= p->step[i].dst;
+	return m;
+}
@@ -1,12 +1,15 @@
 // chvec.h ... interface to functions on ChoiceVectors
 // A ChVec is an array of MAXCHVEC ChVecItems
 // Each ChVecItem is a pair (attr#,bit#)
+// A HashPlan is a ChVec compiled for hashing tuples
 // See chvec.c for details on functions
 
 #ifndef CHVEC_H
 #define CHVEC_H 1
 
 #include "defs.h"
+#include "bits.h"
+#include "hash.h"
 #include "reln.h"
 
 #define MAXCHVEC 32
@@ -15,7 +18,27 @@ typedef struct _ChVecItem { Byte att; Byte bit; } ChVecItem;
 
 typedef ChVecItem ChVec[MAXCHVEC];
 
+// one gather step: the bits src of an attribute's hash, in order
+// (or reversed), go to the bits dst of the tuple hash
+typedef struct _HashStep {
+	Byte att; Byte rev; Byte nbits; Bits src; Bits dst;
+} HashStep;
+
+typedef struct _HashPlan {
+	Count nrefs;            // # attributes the choice vector uses
+	Byte refs[MAXCHVEC];    // those attributes, in increasing order
+	Count nsteps;           // # entries in step[]
+	HashStep step[MAXCHVEC];
+	Bool bmi2;              // use PEXT/PDEP for the steps?
+	HashFunc hash;          // hashes each attribute
+	ChVec cv;               // items for the bit-at-a-time fallback
+} HashPlan;
+
 Status parseChVec(Reln r, char *str, ChVec cv);
 void printChVec(ChVec cv);
+void fillChVec(ChVec cv, Count n, Count nattrs);
+void compileHashPlan(ChVec cv, HashFunc hash, HashPlan *p);
+Bits planHash(HashPlan *p, Bits *attHash);
+Bits planMask(HashPlan *p, Count att);
 
 #endif
@@ -1,17 +1,30 @@
 // create.c ... create an empty Relation
 // Ask a query on a named file
-// Usage:  ./create  [-v]  RelName  #attrs  #pages  ChoiceVector
+// Usage:  ./create  [-v]  [-z]  [-H]  [-a Hash]  [-f Fill]  [-n #rows  [-s TupLen]]
+//                  RelName  #attrs  #pages  ChoiceVector  [PageSize]
 // where #attrs = # of attributes in each tuple
 //	   #pages = initial (empty) pages in File
 //	   ChoiceVector = attr,bit:attr,bit:...
+//	   PageSize = bytes per page, a power of 2 (default 1024)
+// -z stores tuples dictionary-encoded within each page
+// -H stores each tuple's hash with it
+// -a picks the function that hashes attributes: wyhash (default)
+//    or jenkins (the one relations made by older versions use)
+// -f sets the target load factor, as a % of data page capacity
+//    (default FILLFACTOR); the file splits to stay below it
+// -n starts the file with enough pages for #rows tuples of (on
+//    average) TupLen chars (default 10 per attribute) at that load
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "util.h"
 #include "reln.h"
+#include "page.h"
+#include "hash.h"
 
-#define USAGE "./create  [-v]  RelName  #attrs  #pages  ChoiceVector"
+#define USAGE "./create  [-v]  [-z]  [-H]  [-a Hash]  [-f Fill]  [-n #rows  [-s TupLen]]  RelName  #attrs  #pages  ChoiceVector  [PageSize]"
+#define MAXPRESIZE (1 << 24)  // most pages -n can ask for
 
 
 // Main ... process args, create relation
@@ -21,24 +34,54 @@ int main(int argc, char **argv)
 	//Reln r;  // handle on the data file
 	int nattrs;  // number of attributes in each tuple
 	int npages;  // initial number of pages
+	int pagesize;  // bytes per page
 	char err[MAXERRMSG];  // buffer for error messages
-	int verbose;  // show extra info on query progress
+	int verbose = 0;  // show extra info on query progress
+	int flags = 0;  // page format flags
+	int fill = FILLFACTOR;  // target load factor (%)
+	int hashid = HASH_WYHASH;  // hash function for attributes
+	long nrows = 0;  // expected #tuples (0 = not given)
+	int tuplen = 0;  // expected average tuple length
+	int offset = 0; // adapt offset for options
 	char *rname;  // name of table/file
 	char *attrs;   // number of attributes in tuples
 	char *pages;   // number of pages in data file
 	char *cv;	  // choice vector
+	char *psize;   // page size (NULL if not given)
 
 	// Process command-line args
 
-	if (argc < 2) fatal(USAGE);
-	if (strcmp(argv[1], "-v") == 0) {
-		if (argc < 6) fatal(USAGE);
-	    verbose = 1; rname = argv[2]; attrs = argv[3]; pages = argv[4]; cv = argv[5];
-	}
-	else {
-		if (argc < 5) fatal(USAGE);
-	    verbose = 0; rname = argv[1]; attrs = argv[2]; pages = argv[3]; cv = argv[4];
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[offset+1], "-z") == 0)
+			flags |= PAGE_COMPRESSED;
+		else if (strcmp(argv[offset+1], "-H") == 0)
+			flags |= PAGE_HASHED;
+		else if (strcmp(argv[offset+1], "-a") == 0 && offset+2 < argc) {
+			hashid = hashID(argv[offset+2]);
+			if (hashid < 0) fatal("Unknown hash function (use wyhash or jenkins)");
+			offset += 1;
+		}
+		else if (strcmp(argv[offset+1], "-f") == 0 && offset+2 < argc) {
+			fill = atoi(argv[offset+2]);
+			offset += 1;
+		}
+		else if (strcmp(argv[offset+1], "-n") == 0 && offset+2 < argc) {
+			nrows = atol(argv[offset+2]);
+			offset += 1;
+		}
+		else if (strcmp(argv[offset+1], "-s") == 0 && offset+2 < argc) {
+			tuplen = atoi(argv[offset+2]);
+			offset += 1;
+		}
+		else
+			fatal(USAGE);
+		offset += 1;
 	}
+	if (argc < offset+5 || argc > offset+6) fatal(USAGE);
+	rname = argv[offset+1]; attrs = argv[offset+2]; pages = argv[offset+3]; cv = argv[offset+4];
+	psize = (argc > offset+5) ? argv[offset+5] : NULL;
 
 	// how many attributes in each tuple
 	nattrs = atoi(attrs);
@@ -53,13 +96,48 @@ int main(int argc, char **argv)
 		sprintf(err, "Invalid #pages: %d (must be 0 < # < 65)", nattrs);
 		fatal(err);
 	}
+	// how big is each page
+	pagesize = (psize == NULL) ? PAGESIZE : atoi(psize);
+	if (!validPageSize(pagesize)) {
+		sprintf(err, "Invalid page size: %d (must be a power of 2, %d..%d)",
+		        pagesize, MINPAGESIZE, MAXPAGESIZE);
+		fatal(err);
+	}
+
+	if (fill < 10 || fill > 100) {
+		sprintf(err, "Invalid fill: %d (must be 10..100)", fill);
+		fatal(err);
+	}
+	if (nrows < 0 || tuplen < 0 || tuplen >= MAXTUPLEN) {
+		sprintf(err, "Invalid #rows or tuple length");
+		fatal(err);
+	}
+	if (tuplen == 0) tuplen = 10*nattrs;
+
 	// convert to least 2^d >= npages
 	// d gives initial depth of file
 	int d = 0, np = 1;
 	while (np < npages) { d++; np <<= 1; }
 
+	// enough pages for nrows tuples at the target load
+	// (then d is the depth of the largest full level)
+	double need = (double)nrows * recordSpace(tuplen, flags) * 100
+	              / ((double)pageCapacity(pagesize) * fill);
+	if (need > MAXPRESIZE) {
+		sprintf(err, "Too many rows: %ld (at most %d pages)",
+		        nrows, MAXPRESIZE);
+		fatal(err);
+	}
+	if (need > np) {
+		np = (int)need;
+		if (np < need) np++;
+		for (d = 0; (2 << d) <= np; d++) ;
+	}
+
 	if (verbose)
-		printf("#a=%d, #p=%d, d=%d\n", nattrs, np, d);
+		printf("#a=%d, #p=%d, d=%d, fill=%d%%, pagesize=%d, hash=%s%s%s\n", nattrs, np, d, fill, pagesize, hashName(hashid),
+		       (flags & PAGE_COMPRESSED) ? ", compressed" : "",
+		       (flags & PAGE_HASHED) ? ", hashed" : "");
 
 	// Open files for the Relation and initialise
 
@@ -67,7 +145,7 @@ int main(int argc, char **argv)
 		sprintf(err, "Relation %s already exists", rname);
 		fatal(err);
 	}
-	if (newRelation(rname, nattrs, np, d, cv) != OK) {
+	if (newRelation(rname, nattrs, np, d, cv, pagesize, flags, fill, hashid) != OK) {
 		sprintf(err, "Problems while creating relation %s", rname);
 		fatal(err);
 	}
@@ -11,11 +11,29 @@
 #include "util.h"
 
 #define PAGESIZE    1024
+#define MINPAGESIZE 1024
+#define MAXPAGESIZE 65536
+// sizes and limits may be set when building (check.sh makes them small)
+#ifndef BUFBYTES
+#define BUFBYTES    (4*1024*1024)
+#endif
+#ifndef BULKMEM
+#define BULKMEM     (64*1024*1024)
+#endif
+#ifndef READBUF
+#define READBUF     (1024*1024)
+#endif
+#define PREFETCH    8
+#define FILLFACTOR  80
+#define WALBATCH    1000
+#ifndef WALCHECKPOINT
+#define WALCHECKPOINT 4096
+#endif
 #define NO_PAGE     0xffffffff
 #define MAXERRMSG   200
 #define MAXTUPLEN   200
 #define MAXRELNAME  200
-#define MAXFILENAME MAXRELNAME+8
+#define MAXFILENAME (MAXRELNAME+16)
 #define MAXBITS     32
 #define OK          0
 #define TRUE        1
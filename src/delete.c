@@ -0,0 +1,65 @@
+// delete.c ... delete tuples from a Relation
+// Removes every tuple matching a query
+// Usage:  ./delete  [-v]  from  RelName  where  'v1,v2,v3,v4,...'
+// - Any vi can be '?' to indicate an unknown value
+// - Any vi can contain '%' as a wildcard matching zero or more characters
+// Only the buckets that could hold matches are visited; the file
+// contracts if it ends up much emptier than its target fill
+
+#include "defs.h"
+#include "select.h"
+#include "tuple.h"
+#include "reln.h"
+
+#define USAGE "./delete  [-v]  from  RelName  where  v1,v2,v3,v4,..."
+
+// Main ... process args, run delete
+
+int main(int argc, char **argv)
+{
+	Reln r;  // handle on the open relation
+	Selection s;  // handle on the selection
+	char err[MAXERRMSG+MAXRELNAME];  // buffer for error messages
+	int offset = 0; // adapt offset for options
+	int verbose = 0;  // show how many tuples went
+	char *rname;  // name of table/file
+	char *valstr;   // a query string of values for selection
+
+	// process command-line args
+
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0)
+			verbose = 1;
+		else
+			fatal(USAGE);
+		offset += 1;
+	}
+	if (argc != offset+5) fatal(USAGE);
+	if (strcmp(argv[offset+1], "from") != 0 || strcmp(argv[offset+3], "where") != 0)
+		fatal(USAGE);
+	rname = argv[offset+2];  valstr = argv[offset+4];
+
+	// set up relation for writing
+
+	if (!existsRelation(rname)) {
+		sprintf(err, "No such relation: %s",rname);
+		fatal(err);
+	}
+	if ((r = openRelation(rname,"r+")) == NULL) {
+		sprintf(err, "Can't open relation: %s",rname);
+		fatal(err);
+	}
+	if (nvals(valstr) != nattrs(r) || (s = startSelection(r, valstr)) == NULL) {
+		sprintf(err, "Invalid selection: %s",valstr);
+		fatal(err);
+	}
+
+	Count n = deleteSelection(s);
+	if (verbose) printf("Deleted %d tuples\n", n);
+
+	// clean up
+	closeSelection(s);
+	closeRelation(r);
+
+	return 0;
+}
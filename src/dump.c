@@ -5,6 +5,7 @@
 #include "defs.h"
 #include "reln.h"
 #include "page.h"
+#include "buffer.h"
 
 void showAllTuples(Page);
 
@@ -23,26 +24,26 @@ int main(int argc, char **argv)
 
 	if (!existsRelation(relname))
 		fatal("No such relation");
-	Reln r = openRelation(relname,"r");
+	Reln r = openRelation(relname,"rm");
 	if (r == NULL)
 		fatal("Can't open relation");
 
 	for (Offset pid = 0; pid < npages(r); pid++) {
 		printf("Bucket[%d]\n",pid);
 		// show tuples in data file
-		Page pg = getPage(dataFile(r),pid);
+		Page pg = pinPage(bufPool(r),dataFile(r),pid);
 		showAllTuples(pg);
 		// show tuples in overflow pages
 		Page ovpg;  PageID ovp;
 		ovp = pageOvflow(pg);
 		while (ovp != NO_PAGE) {
 			printf("Ovflow->\n");
-			ovpg = getPage(ovflowFile(r), ovp);
+			ovpg = pinPage(bufPool(r), ovflowFile(r), ovp);
 			showAllTuples(ovpg);
 			ovp = pageOvflow(ovpg);
-			free(ovpg);
+			unpinPage(bufPool(r), ovpg, FALSE);
 		}
-		free(pg);
+		unpinPage(bufPool(r), pg, FALSE);
 	}
 	closeRelation(r);
 
@@ -53,10 +54,10 @@ int main(int argc, char **argv)
 
 void showAllTuples(Page pg)
 {
-		Count ntups = pageNTuples(pg);
-		char *c = pageData(pg);
-		for (int i = 0; i < ntups; i++) {
-			printf("%s\n", c);
-			c += strlen(c) + 1;
+		Count pos = 0;
+		Tuple t;
+		char buf[MAXTUPLEN];
+		while ((t = pageNextTuple(pg, &pos, buf)) != NULL) {
+			printf("%s\n", t);
 		}
 }
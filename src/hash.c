@@ -93,3 +93,541 @@ hash_any(unsigned char *k, int keylen)
 	final(a, b, c);
 	return c;
 }
+
+// hash_wy ... a 64-bit hash in the style of wyhash
+// - reads up to 16 bytes at a time and mixes them with 64x64->128 bit
+//   multiplies, so an attribute of a few dozen chars takes only a
+//   handful of steps (hash_any takes three rounds of mix() per 12)
+// - words are read little-endian on any host, so the hash of a
+//   value is the same on every machine
+// - the 64-bit result is folded to 32 bits for Bits
+
+#include <stdint.h>
+
+static const uint64_t wysecret[4] = {
+	0xa0761d6478bd642full, 0xe7037ed1a0b428dbull,
+	0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+// wymix(wysecret[0], wysecret[1]), the starting state
+#define WYSEED 0x1ff5c2923a788d2cull
+
+// (b,a) = the 128-bit product a*b
+#ifdef __SIZEOF_INT128__
+#define wymum(a,b) \
+{ \
+  unsigned __int128 r_ = (unsigned __int128)(a) * (b); \
+  a = (uint64_t)r_;  b = (uint64_t)(r_ >> 64); \
+}
+#else
+static void wymum64(uint64_t *a, uint64_t *b)
+{
+	uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl, lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo; *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+}
+#define wymum(a,b) wymum64(&(a), &(b))
+#endif
+
+// h = both halves of the product x*y folded together
+#define wymix(h,x,y) \
+{ \
+  uint64_t x_ = (x), y_ = (y); \
+  wymum(x_, y_); \
+  h = x_ ^ y_; \
+}
+
+// little-endian 8- and 4-byte words at k
+// (WORDS_BIGENDIAN is only set by PostgreSQL's configure, so the
+// compiler's own byte order macros decide here)
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define wyr8(k) \
+  ((uint64_t)(k)[0] | ((uint64_t)(k)[1] << 8) | ((uint64_t)(k)[2] << 16) \
+   | ((uint64_t)(k)[3] << 24) | ((uint64_t)(k)[4] << 32) \
+   | ((uint64_t)(k)[5] << 40) | ((uint64_t)(k)[6] << 48) \
+   | ((uint64_t)(k)[7] << 56))
+#define wyr4(k) \
+  ((uint64_t)(k)[0] | ((uint64_t)(k)[1] << 8) | ((uint64_t)(k)[2] << 16) \
+   | ((uint64_t)(k)[3] << 24))
+#else
+static uint64_t wyw8(unsigned char *k) { uint64_t v; memcpy(&v, k, 8); return v; }
+static uint64_t wyw4(unsigned char *k) { uint32_t v; memcpy(&v, k, 4); return v; }
+#define wyr8(k) wyw8(k)
+#define wyr4(k) wyw4(k)
+#endif
+
+// the words a and b that hash_wy takes from a key of len <= 16 bytes
+static inline __attribute__((always_inline))
+void wyshort(unsigned char *k, uint64_t len, uint64_t *a, uint64_t *b)
+{
+	if (len >= 4) {
+		uint64_t mid = (len >> 3) << 2;
+		*a = (wyr4(k) << 32) | wyr4(k + mid);
+		*b = (wyr4(k + len - 4) << 32) | wyr4(k + len - 4 - mid);
+	}
+	else if (len > 0) {
+		*a = ((uint64_t)k[0] << 16) | ((uint64_t)k[len >> 1] << 8) | k[len - 1];
+		*b = 0;
+	}
+	else
+		*a = *b = 0;
+}
+
+Bits
+hash_wy(unsigned char *k, int keylen)
+{
+	const uint64_t *s = wysecret;
+	uint64_t len = keylen, a, b, h;
+	uint64_t seed = WYSEED;
+	if (len <= 16)
+		wyshort(k, len, &a, &b);
+	else {
+		uint64_t i = len;
+		if (i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+			do {
+				wymix(seed, wyr8(k) ^ s[1], wyr8(k + 8) ^ seed);
+				wymix(seed1, wyr8(k + 16) ^ s[2], wyr8(k + 24) ^ seed1);
+				wymix(seed2, wyr8(k + 32) ^ s[3], wyr8(k + 40) ^ seed2);
+				k += 48; i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (i > 16) {
+			wymix(seed, wyr8(k) ^ s[1], wyr8(k + 8) ^ seed);
+			k += 16; i -= 16;
+		}
+		a = wyr8(k + i - 16);
+		b = wyr8(k + i - 8);
+	}
+	a ^= s[1]; b ^= seed;
+	wymum(a, b);
+	wymix(h, a ^ s[0] ^ len, b ^ s[1]);
+	return (Bits)(h ^ (h >> 32));
+}
+
+// hashBatch ... hash n keys with the same function
+// - hash_any keys are hashed 16 or 8 at a time, one per 32-bit lane
+//   of an AVX-512 or AVX2 register, when the CPU has them; each lane
+//   runs exactly the steps of hash_any, so the results are the same
+// - keys of different lengths share a register: lanes that have run
+//   out of 12-byte blocks keep their state while the others mix, and
+//   every lane adds its tail at the end
+// - hash_wy keys are hashed 8 or 4 at a time, one per 64-bit lane;
+//   each lane's words are read as hash_wy reads them, and its two
+//   64x64->128 bit products are built from 32x32->64 bit ones (the
+//   widest multiply either has); keys over 16 bytes, which hash_wy
+//   loops over, are redone one at a time
+// - keys left over are hashed one at a time
+// - limitHashLanes keeps it to narrower registers (to check them
+//   against each other on a CPU that has both)
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_LANES 1
+#include <immintrin.h>
+
+// mix() and final() on vectors of lanes, given the lane operations
+#define vmix(a,b,c,ADD,SUB,XOR,ROT) \
+{ \
+  a = SUB(a, c);  a = XOR(a, ROT(c, 4));  c = ADD(c, b); \
+  b = SUB(b, a);  b = XOR(b, ROT(a, 6));  a = ADD(a, c); \
+  c = SUB(c, b);  c = XOR(c, ROT(b, 8));  b = ADD(b, a); \
+  a = SUB(a, c);  a = XOR(a, ROT(c,16));  c = ADD(c, b); \
+  b = SUB(b, a);  b = XOR(b, ROT(a,19));  a = ADD(a, c); \
+  c = SUB(c, b);  c = XOR(c, ROT(b, 4));  b = ADD(b, a); \
+}
+
+#define vfinal(a,b,c,SUB,XOR,ROT) \
+{ \
+  c = XOR(c, b);  c = SUB(c, ROT(b,14)); \
+  a = XOR(a, c);  a = SUB(a, ROT(c,11)); \
+  b = XOR(b, a);  b = SUB(b, ROT(a,25)); \
+  c = XOR(c, b);  c = SUB(c, ROT(b,16)); \
+  a = XOR(a, c);  a = SUB(a, ROT(c, 4)); \
+  b = XOR(b, a);  b = SUB(b, ROT(a,14)); \
+  c = XOR(c, b);  c = SUB(c, ROT(b,24)); \
+}
+
+// Each lane's words are loaded straight from its key, 12 bytes at a
+// time, with masked loads that never touch a byte past the key's
+// end; the 16 (or 8) loads are then transposed into one vector each
+// of a, b and c words. Block r of lane i is bytes 12r.. of key i;
+// the tail (at = -1) is the bytes after its last whole block.
+
+// #bytes of key i to load for block r (or its tail if r < 0)
+static inline __attribute__((always_inline))
+int laneBytes(int *lens, int i, int r)
+{
+	int n = lens[i] - 12*((r < 0) ? lens[i]/12 : r);
+	return (n < 0) ? 0 : (n > 12) ? 12 : n;
+}
+
+static inline __attribute__((always_inline))
+unsigned char *laneStart(unsigned char **keys, int *lens, int i, int r)
+{
+	return keys[i] + 12*((r < 0) ? lens[i]/12 : r);
+}
+
+// nb[i] = #whole blocks in key i; returns the most any key has
+static int laneBlocks(int *lens, int *nb, int W)
+{
+	int most = 0;
+	for (int i = 0; i < W; i++) {
+		nb[i] = lens[i] / 12;
+		if (nb[i] > most) most = nb[i];
+	}
+	return most;
+}
+
+#define LANE static inline __attribute__((always_inline))
+
+#define ADD16(x,y) _mm512_add_epi32(x, y)
+#define SUB16(x,y) _mm512_sub_epi32(x, y)
+#define XOR16(x,y) _mm512_xor_si512(x, y)
+#define ROT16(x,k) _mm512_rol_epi32(x, k)
+
+#define AVX512 "avx512f,avx512bw,avx512vl"
+
+// bytes of key i for block r, zero-padded to 16
+__attribute__((target(AVX512)))
+LANE __m128i load16(unsigned char **keys, int *lens, int i, int r)
+{
+	__mmask16 m = (1u << laneBytes(lens, i, r)) - 1;
+	return _mm_maskz_loadu_epi8(m, laneStart(keys, lens, i, r));
+}
+
+// keys i..i+3 for block r, one to each 128-bit quarter
+__attribute__((target(AVX512)))
+LANE __m512i quad16(unsigned char **keys, int *lens, int i, int r)
+{
+	__m512i q = _mm512_castsi128_si512(load16(keys, lens, i, r));
+	q = _mm512_inserti32x4(q, load16(keys, lens, i+1, r), 1);
+	q = _mm512_inserti32x4(q, load16(keys, lens, i+2, r), 2);
+	return _mm512_inserti32x4(q, load16(keys, lens, i+3, r), 3);
+}
+
+// the a, b and c words of block r of keys[0..15]
+__attribute__((target(AVX512)))
+LANE void words16(unsigned char **keys, int *lens, int r,
+                    __m512i *a, __m512i *b, __m512i *c)
+{
+	// quad j holds a,b,c,0 of keys 4j..4j+3
+	__m512i q0 = quad16(keys, lens, 0, r), q1 = quad16(keys, lens, 4, r);
+	__m512i q2 = quad16(keys, lens, 8, r), q3 = quad16(keys, lens, 12, r);
+	// gather a and b words of keys 0..7 (and 8..15), then c words
+	__m512i ab = _mm512_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28,
+	                               1, 5, 9, 13, 17, 21, 25, 29);
+	__m512i cc = _mm512_setr_epi32(2, 6, 10, 14, 18, 22, 26, 30,
+	                               2, 6, 10, 14, 18, 22, 26, 30);
+	__m512i ab01 = _mm512_permutex2var_epi32(q0, ab, q1);
+	__m512i ab23 = _mm512_permutex2var_epi32(q2, ab, q3);
+	__m512i c01 = _mm512_permutex2var_epi32(q0, cc, q1);
+	__m512i c23 = _mm512_permutex2var_epi32(q2, cc, q3);
+	*a = _mm512_shuffle_i64x2(ab01, ab23, 0x44);
+	*b = _mm512_shuffle_i64x2(ab01, ab23, 0xee);
+	*c = _mm512_shuffle_i64x2(c01, c23, 0x44);
+}
+
+// hash_any of keys[0..15], in the 16 lanes of an AVX-512 register
+
+__attribute__((target(AVX512)))
+static void jenkins16(unsigned char **keys, int *lens, Bits *out)
+{
+	__m512i a = _mm512_set1_epi32(0x9e3779b9), b = a;
+	__m512i c = _mm512_set1_epi32(3923095);
+	__m512i wa, wb, wc;
+	int nbs[16], rounds = laneBlocks(lens, nbs, 16);
+	__m512i nb = _mm512_loadu_si512((void *)nbs);
+	for (int r = 0; r < rounds; r++) {
+		words16(keys, lens, r, &wa, &wb, &wc);
+		__m512i na = ADD16(a, wa), nb_ = ADD16(b, wb), nc = ADD16(c, wc);
+		vmix(na, nb_, nc, ADD16, SUB16, XOR16, ROT16);
+		// only lanes with a block r take the result
+		__mmask16 on = _mm512_cmpgt_epi32_mask(nb, _mm512_set1_epi32(r));
+		a = _mm512_mask_mov_epi32(a, on, na);
+		b = _mm512_mask_mov_epi32(b, on, nb_);
+		c = _mm512_mask_mov_epi32(c, on, nc);
+	}
+	words16(keys, lens, -1, &wa, &wb, &wc);
+	// the lowest byte of c is reserved for the length
+	a = ADD16(a, wa); b = ADD16(b, wb);
+	c = ADD16(c, _mm512_slli_epi32(wc, 8));
+	vfinal(a, b, c, SUB16, XOR16, ROT16);
+	_mm512_storeu_si512((void *)out, c);
+}
+
+#define ADD8(x,y)  _mm256_add_epi32(x, y)
+#define SUB8(x,y)  _mm256_sub_epi32(x, y)
+#define XOR8(x,y)  _mm256_xor_si256(x, y)
+#define ROT8(x,k)  _mm256_or_si256(_mm256_slli_epi32(x, k), _mm256_srli_epi32(x, 32-(k)))
+
+// the n <= 16 bytes at k, zero-padded to 16
+// (whole 4-byte words with a masked load, the rest one by one)
+__attribute__((target("avx2")))
+LANE __m128i bytes8(unsigned char *k, int n)
+{
+	__m128i at = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i whole = _mm_cmpgt_epi32(_mm_set1_epi32(n/4), at);
+	__m128i v = _mm_maskload_epi32((int *)k, whole);
+	unsigned char *t = k + n - n%4;
+	Bits last = 0;
+	switch (n % 4)			/* all the case statements fall through */
+	{
+		case 3: last |= (Bits)t[2] << 16;
+		case 2: last |= (Bits)t[1] << 8;
+		case 1: last |= t[0];
+	}
+	__m128i part = _mm_cmpeq_epi32(_mm_set1_epi32(n/4), at);
+	return _mm_or_si128(v, _mm_and_si128(part, _mm_set1_epi32(last)));
+}
+
+// bytes of key i for block r, zero-padded to 16
+__attribute__((target("avx2")))
+LANE __m128i load8(unsigned char **keys, int *lens, int i, int r)
+{
+	return bytes8(laneStart(keys, lens, i, r), laneBytes(lens, i, r));
+}
+
+// keys i and i+4 for block r, in the two 128-bit halves
+__attribute__((target("avx2")))
+LANE __m256i pair8(unsigned char **keys, int *lens, int i, int r)
+{
+	__m256i p = _mm256_castsi128_si256(load8(keys, lens, i, r));
+	return _mm256_inserti128_si256(p, load8(keys, lens, i+4, r), 1);
+}
+
+// the a, b and c words of block r of keys[0..7]
+__attribute__((target("avx2")))
+LANE void words8(unsigned char **keys, int *lens, int r,
+                   __m256i *a, __m256i *b, __m256i *c)
+{
+	// a 4x4 transpose within each half
+	__m256i p0 = pair8(keys, lens, 0, r), p1 = pair8(keys, lens, 1, r);
+	__m256i p2 = pair8(keys, lens, 2, r), p3 = pair8(keys, lens, 3, r);
+	__m256i t0 = _mm256_unpacklo_epi32(p0, p1);
+	__m256i t1 = _mm256_unpacklo_epi32(p2, p3);
+	__m256i t2 = _mm256_unpackhi_epi32(p0, p1);
+	__m256i t3 = _mm256_unpackhi_epi32(p2, p3);
+	*a = _mm256_unpacklo_epi64(t0, t1);
+	*b = _mm256_unpackhi_epi64(t0, t1);
+	*c = _mm256_unpacklo_epi64(t2, t3);
+}
+
+// hash_any of keys[0..7], in the 8 lanes of an AVX2 register
+
+__attribute__((target("avx2")))
+static void jenkins8(unsigned char **keys, int *lens, Bits *out)
+{
+	__m256i a = _mm256_set1_epi32(0x9e3779b9), b = a;
+	__m256i c = _mm256_set1_epi32(3923095);
+	__m256i wa, wb, wc;
+	int nbs[8], rounds = laneBlocks(lens, nbs, 8);
+	__m256i nb = _mm256_loadu_si256((__m256i *)nbs);
+	for (int r = 0; r < rounds; r++) {
+		words8(keys, lens, r, &wa, &wb, &wc);
+		__m256i na = ADD8(a, wa), nb_ = ADD8(b, wb), nc = ADD8(c, wc);
+		vmix(na, nb_, nc, ADD8, SUB8, XOR8, ROT8);
+		// only lanes with a block r take the result
+		__m256i on = _mm256_cmpgt_epi32(nb, _mm256_set1_epi32(r));
+		a = _mm256_blendv_epi8(a, na, on);
+		b = _mm256_blendv_epi8(b, nb_, on);
+		c = _mm256_blendv_epi8(c, nc, on);
+	}
+	words8(keys, lens, -1, &wa, &wb, &wc);
+	// the lowest byte of c is reserved for the length
+	a = ADD8(a, wa); b = ADD8(b, wb);
+	c = ADD8(c, _mm256_slli_epi32(wc, 8));
+	vfinal(a, b, c, SUB8, XOR8, ROT8);
+	_mm256_storeu_si256((__m256i *)out, c);
+}
+
+// hash_wy's a and b words (as wyshort makes them) of a key of n <= 16
+// bytes, from the key's bytes: byte j of the pair is byte wyshuf[n][j]
+// of the key, or 0 for Z
+#define Z 0x80
+static const unsigned char wyshuf[17][16] = {
+	{ Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },  // 0
+	{ 0, 0, 0, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },  // 1
+	{ 1, 1, 0, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },  // 2
+	{ 2, 1, 0, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z },  // 3
+	{ 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 },  // 4
+	{ 0, 1, 2, 3, 0, 1, 2, 3, 1, 2, 3, 4, 1, 2, 3, 4 },  // 5
+	{ 0, 1, 2, 3, 0, 1, 2, 3, 2, 3, 4, 5, 2, 3, 4, 5 },  // 6
+	{ 0, 1, 2, 3, 0, 1, 2, 3, 3, 4, 5, 6, 3, 4, 5, 6 },  // 7
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 6, 7 },  // 8
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 1, 2, 3, 4, 5, 6, 7, 8 },  // 9
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 2, 3, 4, 5, 6, 7, 8, 9 },  // 10
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 3, 4, 5, 6, 7, 8, 9, 10 },  // 11
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 },  // 12
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 5, 6, 7, 8, 9, 10, 11, 12 },  // 13
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 6, 7, 8, 9, 10, 11, 12, 13 },  // 14
+	{ 4, 5, 6, 7, 0, 1, 2, 3, 7, 8, 9, 10, 11, 12, 13, 14 },  // 15
+	{ 8, 9, 10, 11, 0, 1, 2, 3, 4, 5, 6, 7, 12, 13, 14, 15 },  // 16
+};
+#undef Z
+
+// (lo,hi) = the 128-bit products a*b, lane by lane, from the four
+// products of their 32-bit halves
+#define vmum(lo,hi,a,b,MUL,ADD,SRL,SLL,AND,low) \
+{ \
+  __typeof__(a) ll_ = MUL(a, b), lh_ = MUL(a, SRL(b, 32)); \
+  __typeof__(a) hl_ = MUL(SRL(a, 32), b), hh_ = MUL(SRL(a, 32), SRL(b, 32)); \
+  __typeof__(a) mid_ = ADD(ADD(SRL(ll_, 32), AND(lh_, low)), AND(hl_, low)); \
+  lo = ADD(AND(ll_, low), SLL(mid_, 32)); \
+  hi = ADD(ADD(hh_, SRL(lh_, 32)), ADD(SRL(hl_, 32), SRL(mid_, 32))); \
+}
+
+// hash_wy's a and b words of key i, in the low and high halves
+// (a key over 16 bytes gets words from its first 16)
+__attribute__((target(AVX512)))
+LANE __m128i wyload16(unsigned char **keys, int *lens, int i)
+{
+	int n = (lens[i] > 16) ? 16 : lens[i];
+	__m128i k = _mm_maskz_loadu_epi8((__mmask16)((1u << n) - 1), keys[i]);
+	return _mm_shuffle_epi8(k, _mm_loadu_si128((__m128i *)wyshuf[n]));
+}
+
+// hash_wy of keys[0..7], in the 8 64-bit lanes of an AVX-512 register
+
+__attribute__((target(AVX512)))
+static void wyhash8(unsigned char **keys, int *lens, Bits *out)
+{
+	// q0 holds a,b of keys 0..3, q1 those of keys 4..7
+	__m512i q0 = _mm512_castsi128_si512(wyload16(keys, lens, 0));
+	q0 = _mm512_inserti32x4(q0, wyload16(keys, lens, 1), 1);
+	q0 = _mm512_inserti32x4(q0, wyload16(keys, lens, 2), 2);
+	q0 = _mm512_inserti32x4(q0, wyload16(keys, lens, 3), 3);
+	__m512i q1 = _mm512_castsi128_si512(wyload16(keys, lens, 4));
+	q1 = _mm512_inserti32x4(q1, wyload16(keys, lens, 5), 1);
+	q1 = _mm512_inserti32x4(q1, wyload16(keys, lens, 6), 2);
+	q1 = _mm512_inserti32x4(q1, wyload16(keys, lens, 7), 3);
+	__m512i a = _mm512_permutex2var_epi64(q0,
+	                _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14), q1);
+	__m512i b = _mm512_permutex2var_epi64(q0,
+	                _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15), q1);
+	__m512i len = _mm512_cvtepi32_epi64(_mm256_loadu_si256((__m256i *)lens));
+	__m512i low = _mm512_set1_epi64(0xffffffff), lo, hi;
+	a = _mm512_xor_si512(a, _mm512_set1_epi64(wysecret[1]));
+	b = _mm512_xor_si512(b, _mm512_set1_epi64(WYSEED));
+	vmum(lo, hi, a, b, _mm512_mul_epu32, _mm512_add_epi64,
+	     _mm512_srli_epi64, _mm512_slli_epi64, _mm512_and_si512, low);
+	a = _mm512_xor_si512(lo, _mm512_xor_si512(len,
+	                                        _mm512_set1_epi64(wysecret[0])));
+	b = _mm512_xor_si512(hi, _mm512_set1_epi64(wysecret[1]));
+	vmum(lo, hi, a, b, _mm512_mul_epu32, _mm512_add_epi64,
+	     _mm512_srli_epi64, _mm512_slli_epi64, _mm512_and_si512, low);
+	__m512i h = _mm512_xor_si512(lo, hi);
+	h = _mm512_xor_si512(h, _mm512_srli_epi64(h, 32));
+	_mm256_storeu_si256((__m256i *)out, _mm512_cvtepi64_epi32(h));
+	for (int i = 0; i < 8; i++)
+		if (lens[i] > 16) out[i] = hash_wy(keys[i], lens[i]);
+}
+
+// hash_wy's a and b words of key i, in the low and high halves
+__attribute__((target("avx2")))
+LANE __m128i wyload4(unsigned char **keys, int *lens, int i)
+{
+	int n = (lens[i] > 16) ? 16 : lens[i];
+	return _mm_shuffle_epi8(bytes8(keys[i], n),
+	                        _mm_loadu_si128((__m128i *)wyshuf[n]));
+}
+
+// hash_wy of keys[0..3], in the 4 64-bit lanes of an AVX2 register
+
+__attribute__((target("avx2")))
+static void wyhash4(unsigned char **keys, int *lens, Bits *out)
+{
+	// keys 0 and 2 in one register, 1 and 3 in the other
+	__m256i p02 = _mm256_castsi128_si256(wyload4(keys, lens, 0));
+	p02 = _mm256_inserti128_si256(p02, wyload4(keys, lens, 2), 1);
+	__m256i p13 = _mm256_castsi128_si256(wyload4(keys, lens, 1));
+	p13 = _mm256_inserti128_si256(p13, wyload4(keys, lens, 3), 1);
+	__m256i a = _mm256_unpacklo_epi64(p02, p13);
+	__m256i b = _mm256_unpackhi_epi64(p02, p13);
+	__m256i len = _mm256_cvtepi32_epi64(_mm_loadu_si128((__m128i *)lens));
+	__m256i low = _mm256_set1_epi64x(0xffffffff), lo, hi;
+	a = _mm256_xor_si256(a, _mm256_set1_epi64x(wysecret[1]));
+	b = _mm256_xor_si256(b, _mm256_set1_epi64x(WYSEED));
+	vmum(lo, hi, a, b, _mm256_mul_epu32, _mm256_add_epi64,
+	     _mm256_srli_epi64, _mm256_slli_epi64, _mm256_and_si256, low);
+	a = _mm256_xor_si256(lo, _mm256_xor_si256(len,
+	                                        _mm256_set1_epi64x(wysecret[0])));
+	b = _mm256_xor_si256(hi, _mm256_set1_epi64x(wysecret[1]));
+	vmum(lo, hi, a, b, _mm256_mul_epu32, _mm256_add_epi64,
+	     _mm256_srli_epi64, _mm256_slli_epi64, _mm256_and_si256, low);
+	__m256i h = _mm256_xor_si256(lo, hi);
+	h = _mm256_xor_si256(h, _mm256_srli_epi64(h, 32));
+	// the low half of each lane
+	h = _mm256_permutevar8x32_epi32(h, _mm256_setr_epi32(0, 2, 4, 6,
+	                                                     0, 2, 4, 6));
+	_mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(h));
+	for (int i = 0; i < 4; i++)
+		if (lens[i] > 16) out[i] = hash_wy(keys[i], lens[i]);
+}
+#endif
+
+static Count maxLanes = 512;  // widest register hashBatch uses (bits)
+
+void hashBatch(HashFunc hash, unsigned char **keys, int *lens, Bits *out,
+               Count n)
+{
+	Count i = 0;
+#ifdef HAVE_LANES
+	Bool avx512 = maxLanes >= 512
+	              && __builtin_cpu_supports("avx512f")
+	              && __builtin_cpu_supports("avx512bw")
+	              && __builtin_cpu_supports("avx512vl");
+	Bool avx2 = maxLanes >= 256 && __builtin_cpu_supports("avx2");
+	if (hash == hash_any) {
+		if (avx512)
+			for (; i + 16 <= n; i += 16)
+				jenkins16(&keys[i], &lens[i], &out[i]);
+		else if (avx2)
+			for (; i + 8 <= n; i += 8)
+				jenkins8(&keys[i], &lens[i], &out[i]);
+	}
+	else if (hash == hash_wy) {
+		if (avx512)
+			for (; i + 8 <= n; i += 8)
+				wyhash8(&keys[i], &lens[i], &out[i]);
+		else if (avx2)
+			for (; i + 4 <= n; i += 4)
+				wyhash4(&keys[i], &lens[i], &out[i]);
+	}
+#endif
+	for (; i < n; i++)
+		out[i] = hash(keys[i], lens[i]);
+}
+
+// make hashBatch use registers of at most bits bits: 512 (AVX-512,
+// the default), 256 (AVX2), or 0 (one key at a time); it still only
+// uses those the CPU has
+
+void limitHashLanes(Count bits) { maxLanes = bits; }
+
+// the hash functions a relation can use, by id
+
+static HashFunc hashes[NHASHES] = { hash_any, hash_wy };
+static char *hashNames[NHASHES] = { "jenkins", "wyhash" };
+
+HashFunc hashFunction(Count id)
+{
+	assert(id < NHASHES);
+	return hashes[id];
+}
+
+char *hashName(Count id)
+{
+	return (id < NHASHES) ? hashNames[id] : "unknown";
+}
+
+// id of the hash function called name, or -1 if there is none
+
+int hashID(char *name)
+{
+	for (int i = 0; i < NHASHES; i++)
+		if (strcmp(name, hashNames[i]) == 0) return i;
+	return -1;
+}
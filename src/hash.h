@@ -1,11 +1,26 @@
-// hash.h ... interface to hash function
-// Hash function from PostgreSQL
+// hash.h ... interface to hash functions
+// hash_any is the hash function from PostgreSQL; each relation
+// records which of the functions below hashes its attributes
 
 #ifndef HASH_H
 #define HASH_H 1
 
+#include "defs.h"
 #include "bits.h"
 
+#define HASH_JENKINS 0  // hash_any (every relation made before hash ids)
+#define HASH_WYHASH  1  // hash_wy
+#define NHASHES      2
+
+typedef Bits (*HashFunc)(unsigned char *, int);
+
 Bits hash_any(unsigned char *, int);
+Bits hash_wy(unsigned char *, int);
+HashFunc hashFunction(Count id);
+char *hashName(Count id);
+int hashID(char *name);
+void hashBatch(HashFunc hash, unsigned char **keys, int *lens, Bits *out,
+               Count n);
+void limitHashLanes(Count bits);
 
 #endif
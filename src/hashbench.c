@@ -0,0 +1,130 @@
+// hashbench.c ... compare the hash functions on real attribute values
+// Reads tuples (e.g. from gendata) and times each hash function
+// over all of their attribute values, one at a time and in batches
+// (checking that hashBatch gets the same results)
+// Usage:  ./hashbench  [-r Rounds]  [-w Bits]  < Tuples
+// -r sets how many times every value is hashed (default 50)
+// -w limits batches to registers of at most Bits bits (512, 256 or 0)
+
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include "defs.h"
+#include "hash.h"
+
+#define USAGE "./hashbench  [-r Rounds]  [-w Bits]  < Tuples"
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// print one timing
+
+static void report(char *name, char *how, double secs, Count nvals,
+                   size_t nbytes, int rounds, Bits sink)
+{
+	double n = (double)nvals * rounds;
+	char label[32];
+	sprintf(label, "%s%s", name, how);
+	printf("%-14s %6.1f ns/value  %7.1f MB/s  (%08x)\n", label,
+	       secs * 1e9 / n, nbytes * (double)rounds / secs / 1e6, sink);
+}
+
+// Main ... read values, time each hash function over them
+
+int main(int argc, char **argv)
+{
+	int rounds = 50;  // times each value is hashed
+	int offset = 0;   // adapt offset for options
+
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-r") == 0 && offset+2 < argc) {
+			rounds = atoi(argv[offset+2]);
+			offset += 1;
+		}
+		else if (strcmp(argv[offset+1], "-w") == 0 && offset+2 < argc) {
+			limitHashLanes(atoi(argv[offset+2]));
+			offset += 1;
+		}
+		else
+			fatal(USAGE);
+		offset += 1;
+	}
+	if (argc != offset+1 || rounds < 1) fatal(USAGE);
+
+	// keep every attribute value, '\0'-terminated, in one buffer
+	// (offs[i] is where value i starts)
+	size_t nbytes = 0;
+	char *text = malloc(BULKMEM);
+	assert(text != NULL);
+	Count nvals = 0, maxvals = 1024;
+	size_t *offs = malloc(maxvals * sizeof(size_t));
+	int *lens = malloc(maxvals * sizeof(int));
+	assert(offs != NULL && lens != NULL);
+	char line[MAXTUPLEN];
+	while (fgets(line, MAXTUPLEN, stdin) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		for (char *c = line; ; c++) {
+			int len = strcspn(c, ",");
+			if (nbytes + len + 1 > BULKMEM)
+				fatal("Too many values (at most BULKMEM bytes)");
+			if (nvals == maxvals) {
+				maxvals *= 2;
+				offs = realloc(offs, maxvals * sizeof(size_t));
+				lens = realloc(lens, maxvals * sizeof(int));
+				assert(offs != NULL && lens != NULL);
+			}
+			offs[nvals] = nbytes;
+			lens[nvals++] = len;
+			memcpy(&text[nbytes], c, len);
+			text[nbytes + len] = '\0';
+			nbytes += len + 1;
+			c += len;
+			if (*c == '\0') break;
+		}
+	}
+	if (nvals == 0) fatal("No tuples");
+	char **vals = malloc(nvals * sizeof(char *));
+	assert(vals != NULL);
+	for (Count i = 0; i < nvals; i++) vals[i] = text + offs[i];
+
+	// attribute length distribution
+	int lmax = 0; size_t lsum = 0;
+	for (Count i = 0; i < nvals; i++) {
+		lsum += lens[i];
+		if (lens[i] > lmax) lmax = lens[i];
+	}
+	printf("%d values, mean length %.1f, max %d, %d rounds\n",
+	       nvals, (double)lsum / nvals, lmax, rounds);
+
+	// time each function, one value at a time and then in a batch
+	// (sink keeps the calls from being optimised out)
+	Bits *hs = malloc(nvals * sizeof(Bits));
+	assert(hs != NULL);
+	for (Count id = 0; id < NHASHES; id++) {
+		HashFunc hash = hashFunction(id);
+		Bits sink = 0;
+		double t0 = now();
+		for (int r = 0; r < rounds; r++)
+			for (Count i = 0; i < nvals; i++)
+				sink += hash((unsigned char *)vals[i], lens[i]);
+		double secs = now() - t0;
+		report(hashName(id), "", secs, nvals, lsum, rounds, sink);
+		t0 = now();
+		for (int r = 0; r < rounds; r++)
+			hashBatch(hash, (unsigned char **)vals, lens, hs, nvals);
+		secs = now() - t0;
+		sink = 0;
+		for (Count i = 0; i < nvals; i++) {
+			if (hs[i] != hash((unsigned char *)vals[i], lens[i]))
+				fatal("hashBatch disagrees with the hash function");
+			sink += hs[i];
+		}
+		report(hashName(id), " batch", secs, nvals, lsum, rounds, sink*rounds);
+	}
+	free(hs);
+	free(vals); free(offs); free(lens); free(text);
+	return 0;
+}
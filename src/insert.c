@@ -1,12 +1,47 @@
 // insert.c ... add tuples to a relation
 // Reads tuples from stdin and inserts into Reln
-// Usage:  ./insert  [-v]  RelName
+// Usage:  ./insert  [-v]  [-b]  [-j N]  RelName
+// -b bulk-loads an empty relation (see loadRelation in reln.c)
+// -j N runs a pipeline: one thread parses the input, N threads hash
+//      tuples, and the main thread places them in the relation
 
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
 #include "defs.h"
 #include "reln.h"
 #include "tuple.h"
+#include "queue.h"
 
-#define USAGE "./insert  [-v]  RelName"
+#define USAGE "./insert  [-v]  [-b]  [-j N]  RelName"
+
+// The pipeline passes tuples between threads in batches
+// - batch k goes from the parser to hasher k%N, and the main thread
+//   takes batch k from hasher k%N, so tuples are placed in exactly
+//   the order they were read, as without -j
+// - after the last batch the parser sends NULL to every hasher, and
+//   each hasher passes it on
+
+#define MAXHASHERS 64
+#define BATCHTUPS  256  // tuples per batch
+#define QUEUELEN   8    // batches in flight between two threads
+
+typedef struct {
+	Count n;
+	Tuple tups[BATCHTUPS];  // point into text
+	Bits  hash[BATCHTUPS];
+	char  text[BATCHTUPS*MAXTUPLEN];
+} Batch;
+
+typedef struct {
+	Reln  r;
+	Count n;      // number of hashers
+	Queue *in;    // parser -> hasher i
+	Queue *out;   // hasher i -> main
+	Count id;     // which hasher this is
+} Stage;
+
+static void *parseStage(void *arg);
+static void *hashStage(void *arg);
 
 // Main ... process args, read/insert tuples
 int main(int argc, char **argv)
@@ -15,16 +50,31 @@ int main(int argc, char **argv)
 	Tuple t;  // tuple buffer
 	char err[2*MAXERRMSG];  // buffer for error messages
 	char tup[MAXTUPLEN];  // buffer for printable tuples
-	int verbose;  // show extra info on query progress
+	int verbose = 0;  // show extra info on query progress
+	int bulk = 0;  // load all of stdin at once
+	int nhash = 0;  // hashing threads (0 = no pipeline)
+	int offset = 0; // adapt offset for options
 	char *rname;  // name of table/file
 
 	// process command-line args
 
-	if (argc < 2) fatal(USAGE);
-    if (strcmp(argv[1], "-v") == 0)
-		{ verbose = 1; rname = argv[2]; }
-	else
-		{ verbose = 0; rname = argv[1]; }
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[offset+1], "-b") == 0)
+			bulk = 1;
+		else if (strcmp(argv[offset+1], "-j") == 0) {
+			if (offset+2 >= argc) fatal(USAGE);
+			nhash = atoi(argv[offset+2]);
+			if (nhash < 1 || nhash > MAXHASHERS) fatal(USAGE);
+			offset += 1;
+		}
+		else
+			fatal(USAGE);
+		offset += 1;
+	}
+	if (argc != offset+2) fatal(USAGE);
+	rname = argv[offset+1];
 
 
 	// set up relation for writing
@@ -34,13 +84,62 @@ int main(int argc, char **argv)
 		fatal(err);
 	}
 	if ((r = openRelation(rname,"r+")) == NULL) {
-		sprintf(err, "Can't open relation: %s",argv[1]);
+		sprintf(err, "Can't open relation: %s",rname);
 		fatal(err);
 	}
 
+	if (bulk) {
+		Count n = loadRelation(r,stdin);
+		if (verbose) printf("Loaded %d tuples\n", n);
+		closeRelation(r);
+		return 0;
+	}
+
+	if (nhash > 0) {
+		// start the pipeline and place tuples as they arrive
+		Queue in[MAXHASHERS], out[MAXHASHERS];
+		Stage stages[MAXHASHERS+1];
+		pthread_t threads[MAXHASHERS+1];
+		for (int i = 0; i < nhash; i++) {
+			in[i] = newQueue(QUEUELEN);
+			out[i] = newQueue(QUEUELEN);
+		}
+		for (int i = 0; i <= nhash; i++) {
+			Stage s = { r, nhash, in, out, i };
+			stages[i] = s;
+			void *(*fn)(void *) = (i < nhash) ? hashStage : parseStage;
+			if (pthread_create(&threads[i], NULL, fn, &stages[i]) != 0)
+				fatal("Can't start insert threads");
+		}
+		Batch *b;
+		for (Count k = 0; (b = getQueue(out[k % nhash])) != NULL; k++) {
+			for (Count i = 0; i < b->n; i++) {
+				t = b->tups[i];
+				PageID pid = addHashedToRelation(r, t, b->hash[i]);
+				tupleString(t,tup);
+				if (pid == NO_PAGE) {
+					sprintf(err, "Insert of %s failed\n", tup);
+					fatal(err);
+				}
+				if (verbose) printf("%s -> %d\n",tup,pid);
+			}
+			free(b);
+		}
+		for (int i = 0; i <= nhash; i++)
+			pthread_join(threads[i], NULL);
+		for (int i = 0; i < nhash; i++) {
+			freeQueue(in[i]);
+			freeQueue(out[i]);
+		}
+		if (verbose) bufPoolStats(bufPool(r));
+		closeRelation(r);
+		return 0;
+	}
+
 	// read stdin and insert tuples
 
-	while ((t = readTuple(r,stdin)) != NULL) {
+	TupleReader rd = newTupleReader(r,stdin);
+	while ((t = nextTuple(rd)) != NULL) {
 		PageID pid;
 		pid = addToRelation(r,t);
 
@@ -50,13 +149,57 @@ int main(int argc, char **argv)
 			fatal(err);
 		}
 		if (verbose) printf("%s -> %d\n",tup,pid);
-		free(t);
 	}
+	freeTupleReader(rd);
 
 	// clean up
 
+	if (verbose) bufPoolStats(bufPool(r));
 	closeRelation(r);
 
 	return 0;
 }
 
+
+// parse stdin into batches of tuples and deal them out to the hashers
+
+static void *parseStage(void *arg)
+{
+	Stage *s = arg;
+	TupleReader rd = newTupleReader(s->r,stdin);
+	Count k = 0;
+	Tuple t = NULL;
+	do {
+		Batch *b = malloc(sizeof(Batch));
+		assert(b != NULL);
+		b->n = 0;
+		char *c = b->text;
+		while (b->n < BATCHTUPS && (t = nextTuple(rd)) != NULL) {
+			// the reader's copy is gone after the next call
+			b->tups[b->n++] = strcpy(c, t);
+			c += strlen(c)+1;
+		}
+		if (b->n > 0)
+			putQueue(s->in[k++ % s->n], b);
+		else
+			free(b);
+	} while (t != NULL);
+	for (Count i = 0; i < s->n; i++)
+		putQueue(s->in[(k+i) % s->n], NULL);
+	freeTupleReader(rd);
+	return NULL;
+}
+
+// hash every tuple in each batch and pass it on
+
+static void *hashStage(void *arg)
+{
+	Stage *s = arg;
+	Batch *b;
+	while ((b = getQueue(s->in[s->id])) != NULL) {
+		tupleHashes(s->r, b->tups, b->n, b->hash);
+		putQueue(s->out[s->id], b);
+	}
+	putQueue(s->out[s->id], NULL);
+	return NULL;
+}
@@ -0,0 +1,464 @@
+// match.c ... compiled selection patterns
+// A Matcher tests tuples against a pattern ('v1,v2,...' as for
+// query) without taking the pattern apart again for every tuple
+
+#include <math.h>
+#include "defs.h"
+#include "match.h"
+#include "tuple.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_LANES 1
+#include <immintrin.h>
+#endif
+
+// A pattern value is compiled into a predicate on its attribute
+// - '?' (or a value of nothing but '%'s) matches anything, so it
+//   has no predicate
+// - a value without '%' must equal the attribute (MATCH_EXACT)
+// - 'lit%', '%lit' and '%lit%' are tested directly (MATCH_PREFIX,
+//   MATCH_SUFFIX, MATCH_CONTAINS), lit being the value less its '%'s
+// - anything else goes to likeMatch (MATCH_LIKE)
+// Predicates are kept in attribute order; matchTuple walks the
+// tuple's fields in place, skipping those with no predicate, and
+// gives up at the first one that fails
+// Values are trimmed of spaces, as tupleMatch does
+
+#define MATCH_EXACT    0
+#define MATCH_PREFIX   1
+#define MATCH_SUFFIX   2
+#define MATCH_CONTAINS 3
+#define MATCH_LIKE     4
+
+// A literal is searched for by its two rarest chars (see rarity),
+// which are compared at every position before the rest of it is
+typedef struct {
+	char  *s;     // its chars (not '\0'-terminated)
+	Count  n;     // how many
+	Count  i1;    // offset of its rarest char
+	Count  i2;    // and of its next rarest (i1 if n == 1)
+} Lit;
+
+typedef struct {
+	Count  att;   // attribute tested
+	Count  op;    // MATCH_*
+	Lit   *segs;  // the literal, or for MATCH_LIKE those between '%'s
+	Count  nsegs; // how many
+	Bool   head;  // MATCH_LIKE: segs[0] must start the value
+	Bool   tail;  // and segs[nsegs-1] must end it
+} Pred;
+
+struct MatcherRep {
+	Count  npreds;
+	Pred  *preds; // one per attribute with a value, in attribute order
+	Lit   *lits;  // the segs of all preds
+	char  *text;  // copy of the pattern, which lits point into
+	// Region scans (see markRegion)
+	Lit   *anchor; // the rarest literal, NULL if none
+	char  *base;   // start of the region last marked
+	Bits  *hits;   // bit i: the anchor starts at base[i]
+	Bits  *ends;   // bit i: base[i] is '\0'
+};
+
+// Helpers
+static double newLit(Lit *l, char *s, Count n);
+static char *find(Lit *l, char *s, Count slen);
+static Bool matchSegs(Pred *p, char *c, Count len);
+static Count markScalar(Lit *l, char *s, Count n, Count from,
+                        Bits *hits, Bits *ends);
+#ifdef HAVE_LANES
+static Count markAVX2(Lit *l, char *s, Count n, Bits *hits, Bits *ends);
+static Count markSSE2(Lit *l, char *s, Count n, Bits *hits, Bits *ends);
+#endif
+
+// compile pattern for tuples with nattrs attributes
+// attributes missing from the end of the pattern match anything
+
+Matcher newMatcher(Tuple pattern, Count nattrs)
+{
+	Matcher m = malloc(sizeof(struct MatcherRep));
+	assert(m != NULL);
+	m->preds = malloc(nattrs * sizeof(Pred));
+	assert(m->preds != NULL);
+	m->npreds = 0;
+	m->text = copyString(pattern);
+	// each literal takes at least one char of the pattern
+	m->lits = malloc((strlen(pattern)+1) * sizeof(Lit));
+	assert(m->lits != NULL);
+	Count nlits = 0;
+	m->anchor = NULL;
+	double rarest = 0;
+	char *v = m->text;
+	for (Count att = 0; att < nattrs && v != NULL; att++) {
+		Count vlen = strcspn(v, ",");
+		char *next = (v[vlen] == ',') ? v+vlen+1 : NULL;
+		// trim spaces
+		while (vlen > 0 && *v == ' ') { v++; vlen--; }
+		while (vlen > 0 && v[vlen-1] == ' ') vlen--;
+		// where the '%'s are
+		Count lead = 0, trail = 0, inner = 0;
+		while (lead < vlen && v[lead] == '%') lead++;
+		while (trail < vlen-lead && v[vlen-1-trail] == '%') trail++;
+		for (Count i = lead; i < vlen-trail; i++)
+			if (v[i] == '%') inner++;
+		if ((vlen == 1 && *v == '?') || (vlen > 0 && lead == vlen)) {
+			v = next;
+			continue;
+		}
+		Pred p = { att, MATCH_LIKE, &m->lits[nlits], 0,
+		           lead == 0, trail == 0 };
+		if (inner == 0) {
+			if (lead == 0 && trail == 0)
+				p.op = MATCH_EXACT;
+			else if (lead == 0)
+				p.op = MATCH_PREFIX;
+			else if (trail == 0)
+				p.op = MATCH_SUFFIX;
+			else
+				p.op = MATCH_CONTAINS;
+		}
+		// split the value at its '%'s; an empty value is one
+		// empty literal, for MATCH_EXACT
+		Count i = lead, end = vlen - trail;
+		do {
+			Count n = 0;
+			while (i+n < end && v[i+n] != '%') n++;
+			if (n > 0 || end == 0) {
+				Lit *l = &m->lits[nlits++];
+				double r = newLit(l, v+i, n);
+				if (n > 0 && r > rarest) {
+					rarest = r;
+					m->anchor = l;
+				}
+				p.nsegs++;
+			}
+			i += n+1;
+		} while (i < end);
+		m->preds[m->npreds++] = p;
+		v = next;
+	}
+	m->base = NULL;
+	m->hits = m->ends = NULL;
+	if (m->anchor != NULL) {
+		m->hits = malloc(2 * (MAXPAGESIZE/32) * sizeof(Bits));
+		assert(m->hits != NULL);
+		m->ends = m->hits + MAXPAGESIZE/32;
+	}
+	return m;
+}
+
+// does tuple t match m's pattern?
+
+Bool matchTuple(Matcher m, Tuple t)
+{
+	char *c = t;   // start of attribute att
+	Count att = 0;
+	for (Count i = 0; i < m->npreds; i++) {
+		Pred *p = &m->preds[i];
+		for (; att < p->att; att++) {
+			c = strchr(c, ',');
+			if (c == NULL) return FALSE;
+			c++;
+		}
+		// a literal has no ',' or '\0' in it, so matching
+		// its length of c stays inside the attribute
+		Lit *l = p->segs;
+		Count len;
+		switch (p->op) {
+		case MATCH_EXACT:
+			if (strncmp(c, l->s, l->n) != 0) return FALSE;
+			if (c[l->n] != ',' && c[l->n] != '\0') return FALSE;
+			break;
+		case MATCH_PREFIX:
+			if (strncmp(c, l->s, l->n) != 0) return FALSE;
+			break;
+		case MATCH_SUFFIX:
+			len = strcspn(c, ",");
+			if (len < l->n || memcmp(c+len-l->n, l->s, l->n) != 0)
+				return FALSE;
+			break;
+		case MATCH_CONTAINS:
+			len = strcspn(c, ",");
+			if (find(l, c, len) == NULL) return FALSE;
+			break;
+		default:
+			len = strcspn(c, ",");
+			if (!matchSegs(p, c, len)) return FALSE;
+			break;
+		}
+	}
+	return TRUE;
+}
+
+// Region scans
+// Every tuple that matches m holds m's anchor, the rarest of its
+// literals, so a scan can look for the anchor in all of a page's
+// tuples at once and skip those it is not in
+// - markRegion compares the anchor's two rarest chars (Lit) with 32
+//   positions at a time, in AVX2 or SSE2 registers when the CPU has
+//   them, and checks the rest of it only where both agree
+// - the positions where it starts, and those of the '\0's ending
+//   tuples, are kept as bitmaps over the region, so regionHit only
+//   has to look for a hit before the tuple's '\0'
+// - a region holds at most MAXPAGESIZE chars, and must not change
+//   while its tuples are tested
+
+// does m have a literal for markRegion to look for?
+
+Bool matchAnchored(Matcher m)
+{
+	return m->anchor != NULL;
+}
+
+// find where m's anchor occurs in the n chars at s, which are
+// whole '\0'-terminated tuples (e.g. the record heap of a page)
+// returns FALSE if it occurs nowhere, so no tuple there matches
+
+Bool markRegion(Matcher m, char *s, Count n)
+{
+	assert(m->anchor != NULL && n <= MAXPAGESIZE);
+	Count p = 0;
+#ifdef HAVE_LANES
+	if (__builtin_cpu_supports("avx2"))
+		p = markAVX2(m->anchor, s, n, m->hits, m->ends);
+	else if (__builtin_cpu_supports("sse2"))
+		p = markSSE2(m->anchor, s, n, m->hits, m->ends);
+#endif
+	m->base = s;
+	Bits any = 0;
+	Count nwords = markScalar(m->anchor, s, n, p, m->hits, m->ends);
+	for (Count w = 0; w < nwords; w++) any |= m->hits[w];
+	return any != 0;
+}
+
+// might tuple t, in the region last marked, match m?
+// (if so, matchTuple decides)
+
+Bool regionHit(Matcher m, Tuple t)
+{
+	Count off = t - m->base;
+	Bits from = ~0u << (off % 32);  // bits for off and after
+	for (Count w = off / 32; ; w++, from = ~0u) {
+		Bits e = m->ends[w] & from, h = m->hits[w] & from;
+		// any hit before the first '\0'?
+		if (e != 0) return (h & ((e & -e) - 1)) != 0;
+		if (h != 0) return TRUE;
+	}
+}
+
+// release a Matcher
+
+void freeMatcher(Matcher m)
+{
+	free(m->preds);
+	free(m->lits);
+	free(m->text);
+	free(m->hits);
+	free(m);
+}
+
+// does the slen chars at s match the plen-char pattern at p, where
+// each '%' matches zero or more characters?
+// (patternMatch for strings that aren't '\0'-terminated)
+
+Bool likeMatch(char *p, Count plen, char *s, Count slen)
+{
+	char *pe = p + plen, *se = s + slen;
+	char *star = NULL, *retry = NULL;
+	while (s < se) {
+		if (p < pe && *p == '%') {
+			// skip consecutive %
+			while (p < pe && *p == '%') p++;
+			star = p;
+			retry = s;
+		}
+		else if (p < pe && *p == *s) {
+			p++;
+			s++;
+		}
+		else if (star != NULL) {
+			// mismatch after %, retry one character later
+			p = star;
+			s = ++retry;
+		}
+		else
+			return FALSE;
+	}
+	while (p < pe && *p == '%') p++;
+	return p == pe;
+}
+
+// How common each char is in attribute values: rough counts per
+// 1000 chars of English text, with digits as common as mid-ranking
+// letters; chars not listed are taken to be rarer than any that are
+static unsigned char freq[256] = {
+	['e'] = 127, ['t'] = 91, ['a'] = 82, ['o'] = 75, ['i'] = 70,
+	['n'] = 67, ['s'] = 63, ['h'] = 61, ['r'] = 60, ['d'] = 43,
+	['l'] = 40, ['c'] = 28, ['u'] = 28, ['m'] = 24, ['w'] = 24,
+	['f'] = 22, ['g'] = 20, ['y'] = 20, ['p'] = 19, ['b'] = 15,
+	['v'] = 10, ['k'] = 8, ['j'] = 2, ['x'] = 2, ['q'] = 1, ['z'] = 1,
+	['0'] = 20, ['1'] = 20, ['2'] = 20, ['3'] = 20, ['4'] = 20,
+	['5'] = 20, ['6'] = 20, ['7'] = 20, ['8'] = 20, ['9'] = 20,
+	[' '] = 150, ['-'] = 5, ['.'] = 5,
+};
+
+#define FREQ(c) (freq[(unsigned char)(c)] + 1)
+
+// set up l for the n chars at s, choosing the chars to search by
+// returns its rarity: about -log2 of the chance that it occurs
+// at a given place, if chars occur independently
+
+static double newLit(Lit *l, char *s, Count n)
+{
+	l->s = s;
+	l->n = n;
+	l->i1 = l->i2 = 0;
+	double rarity = 0;
+	for (Count i = 0; i < n; i++) {
+		rarity += log2(1001.0 / FREQ(s[i]));
+		if (FREQ(s[i]) < FREQ(s[l->i1])) {
+			l->i2 = l->i1;
+			l->i1 = i;
+		}
+		else if (l->i2 == l->i1 || FREQ(s[i]) < FREQ(s[l->i2]))
+			l->i2 = i;
+	}
+	return rarity;
+}
+
+// the first place l occurs in the slen chars at s, or NULL
+// (fields are short, so this is memchr for its rarest char, which
+// glibc already vectorises, and a compare of the rest)
+
+static char *find(Lit *l, char *s, Count slen)
+{
+	if (l->n > slen) return NULL;
+	char r = l->s[l->i1];
+	char *last = s + slen - l->n + l->i1;  // last place r could be
+	for (char *c = s + l->i1; c <= last; c++) {
+		c = memchr(c, r, last - c + 1);
+		if (c == NULL) return NULL;
+		if (memcmp(c - l->i1, l->s, l->n) == 0) return c - l->i1;
+	}
+	return NULL;
+}
+
+// does the len-char value at c match MATCH_LIKE predicate p?
+// the head and tail literals are compared in place, then the others
+// are found in order, each as early as it can be
+
+static Bool matchSegs(Pred *p, char *c, Count len)
+{
+	char *end = c + len;
+	Lit *l = p->segs, *last = p->segs + p->nsegs;
+	if (p->head) {
+		if (len < l->n || memcmp(c, l->s, l->n) != 0) return FALSE;
+		c += l->n;
+		l++;
+	}
+	if (p->tail) {
+		last--;
+		if (end - c < last->n) return FALSE;
+		if (memcmp(end - last->n, last->s, last->n) != 0) return FALSE;
+		end -= last->n;
+	}
+	for (; l < last; l++) {
+		c = find(l, c, end - c);
+		if (c == NULL) return FALSE;
+		c += l->n;
+	}
+	return TRUE;
+}
+
+// mark the chars of region s from from (a multiple of 32) to n one
+// at a time: the tail the vector loops leave, or all of it
+// returns the number of bitmap words the region takes
+
+static Count markScalar(Lit *l, char *s, Count n, Count from,
+                        Bits *hits, Bits *ends)
+{
+	Count nwords = (n + 31) / 32;
+	for (Count w = from / 32; w < nwords; w++)
+		hits[w] = ends[w] = 0;
+	for (Count i = from; i < n; i++) {
+		Bits bit = 1u << (i % 32);
+		if (s[i] == '\0')
+			ends[i/32] |= bit;
+		else if (s[i] == l->s[0] && i + l->n <= n
+		         && memcmp(s+i, l->s, l->n) == 0)
+			hits[i/32] |= bit;
+	}
+	return nwords;
+}
+
+#ifdef HAVE_LANES
+
+// of the places in h (bit i for s[i]) where l's two rarest chars
+// are, those where all of l is
+
+static inline Bits verify(Lit *l, char *s, Bits h)
+{
+	if (l->n <= 2) return h;
+	for (Bits b = h; b != 0; b &= b-1) {
+		Count i = __builtin_ctz(b);
+		if (memcmp(s+i, l->s, l->n) != 0) h &= ~(1u << i);
+	}
+	return h;
+}
+
+// mark region s 32 chars at a time, for as long as the chars l
+// could take from each position are all in the region
+// returns where markScalar should take over
+
+__attribute__((target("avx2")))
+static Count markAVX2(Lit *l, char *s, Count n, Bits *hits, Bits *ends)
+{
+	__m256i c1 = _mm256_set1_epi8(l->s[l->i1]);
+	__m256i c2 = _mm256_set1_epi8(l->s[l->i2]);
+	__m256i nul = _mm256_setzero_si256();
+	Count p;
+	for (p = 0; p + 32 + l->n-1 <= n; p += 32) {
+		__m256i v = _mm256_loadu_si256((__m256i *)(s+p));
+		__m256i v1 = _mm256_loadu_si256((__m256i *)(s+p+l->i1));
+		__m256i v2 = _mm256_loadu_si256((__m256i *)(s+p+l->i2));
+		__m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(v1, c1),
+		                                _mm256_cmpeq_epi8(v2, c2));
+		ends[p/32] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nul));
+		hits[p/32] = verify(l, s+p, _mm256_movemask_epi8(both));
+	}
+	return p;
+}
+
+// as for markAVX2, 16 chars to a register
+
+__attribute__((target("sse2")))
+static inline Bits pairs16(__m128i c1, __m128i c2, Lit *l, char *s)
+{
+	__m128i v1 = _mm_loadu_si128((__m128i *)(s+l->i1));
+	__m128i v2 = _mm_loadu_si128((__m128i *)(s+l->i2));
+	return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(v1, c1),
+	                                       _mm_cmpeq_epi8(v2, c2)));
+}
+
+__attribute__((target("sse2")))
+static inline Bits nuls16(char *s)
+{
+	__m128i v = _mm_loadu_si128((__m128i *)s);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+}
+
+__attribute__((target("sse2")))
+static Count markSSE2(Lit *l, char *s, Count n, Bits *hits, Bits *ends)
+{
+	__m128i c1 = _mm_set1_epi8(l->s[l->i1]);
+	__m128i c2 = _mm_set1_epi8(l->s[l->i2]);
+	Count p;
+	for (p = 0; p + 32 + l->n-1 <= n; p += 32) {
+		Bits h = pairs16(c1, c2, l, s+p) | pairs16(c1, c2, l, s+p+16) << 16;
+		ends[p/32] = nuls16(s+p) | nuls16(s+p+16) << 16;
+		hits[p/32] = verify(l, s+p, h);
+	}
+	return p;
+}
+
+#endif
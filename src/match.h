@@ -0,0 +1,20 @@
+// match.h ... interface to compiled selection patterns
+// See match.c for details of Matcher type and functions
+
+#ifndef MATCH_H
+#define MATCH_H 1
+
+typedef struct MatcherRep *Matcher;
+
+#include "defs.h"
+#include "tuple.h"
+
+Matcher newMatcher(Tuple pattern, Count nattrs);
+Bool matchTuple(Matcher m, Tuple t);
+void freeMatcher(Matcher m);
+Bool matchAnchored(Matcher m);
+Bool markRegion(Matcher m, char *s, Count n);
+Bool regionHit(Matcher m, Tuple t);
+Bool likeMatch(char *p, Count plen, char *s, Count slen);
+
+#endif
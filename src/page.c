@@ -1,102 +1,589 @@
 // page.c ... functions on Pages
 // Reading/writing pages into buffers and manipulating contents
 
+#include <stddef.h>
 #include "defs.h"
 #include "page.h"
 
+// A slot directory entry: where a record lives in the page
+typedef struct {
+	unsigned short off; // offset of record from start of page (0 = unused)
+	unsigned short len; // #bytes in record, less one (for plain tuples,
+	                    //   the #chars excluding '\0')
+} Slot;
+
 // internal representation of pages
 struct PageRep {
-	Offset free;   // offset within data[] of free space
-	Offset ovflow; // Offset of overflow page (if any)
-	Count ntuples; // #tuples in this page
-	char data[1];  // start of data
+	Count  magic;   // PAGE_MAGIC|flags|size|version (legacy: free offset)
+	Offset ovflow;  // Offset of overflow page (if any)
+	Count  ntuples; // #live tuples in this page
+	Count  nslots;  // #entries in slot directory
+	Offset upper;   // offset of start of record heap
+	Slot   slot[1]; // start of slot directory
 };
 
-// A Page is a chunk of memory containing PAGESIZE bytes
-// It is implemented as a struct (free, ovflow, data[1])
-// - free is the offset of the first byte of free space
+// legacy representation of pages (before slotted pages)
+typedef struct {
+	Offset free;    // offset within data[] of free space
+	Offset ovflow;  // Offset of overflow page (if any)
+	Count  ntuples; // #tuples in this page
+	char   data[1]; // start of data
+} LegacyPage;
+
+#define PAGE_MAGIC   0x534c0000
+#define PAGE_VERSION 1
+#define LEGACYSIZE   1024
+#define HDRSIZE      (offsetof(struct PageRep, slot))
+#define LEGACYHDR    (offsetof(LegacyPage, data))
+#define LITERAL      0xff  // field code: value is stored in the record
+#define MAXDICT      0xff  // max #entries in a page dictionary
+#define MAXDICTOFF   0xffff  // max offset in a page dictionary
+
+// A Page is a chunk of memory containing pageSize(p) bytes
+// Each relation fixes its page size (a power of 2) when it is created
+// It is implemented as a slotted page (magic, ovflow, ntuples,
+//   nslots, upper, slot[]) with records packed at the end of the page
+// - magic identifies the page layout and its version, and holds
+//   log2 of the page size in bits 8..12 (0 in pages written before
+//   sizes were recorded, which are PAGESIZE bytes) and PAGE_* flags
+//   in bits 13..15
 // - ovflow is the page id of the next overflow page in bucket
-// - data[] is a sequence of bytes containing tuples
-// - each tuple is a sequence of chars terminated by '\0'
+// - slot[i] gives the offset and length of record i; slots of
+//   deleted tuples are marked unused and may be reused, so the
+//   slot number of a live tuple never changes
+// - the slot directory grows up, the record heap grows down from
+//   the end of the page; free space lies between them
+// - in a plain page, each record is a tuple: a sequence of chars
+//   terminated by '\0'
+// - in a PAGE_COMPRESSED page, slot 0 holds the page's dictionary
+//   of attribute values and every other record is an encoded tuple:
+//   one code byte per attribute value, giving its dictionary entry,
+//   or LITERAL followed by a length byte and the value's chars
+// - dictionary offsets are 16 bits, so a dictionary stops growing
+//   at MAXDICTOFF bytes even in 64KB pages
+// - in a PAGE_HASHED page, every tuple record (plain or encoded)
+//   starts with the tuple's tupleHash(), so splits and scans can
+//   test its hash bits without parsing or hashing the tuple
+// - the dictionary is [#entries, offsets[#entries+1], chars];
+//   entry i is chars offsets[i]..offsets[i+1]-1 of the record, so a
+//   value repeated in many tuples of the page is stored only once
 // - PageID values count # pages from start of file
+// Legacy pages hold a run of '\0'-terminated tuples after a
+//   (free, ovflow, ntuples) header; they are always 1024 bytes
+//   and can be read but not modified (see upgradeRelation in reln.c)
+// Page buffers are normally owned by the buffer pool (buffer.c)
+
+// is p in the legacy (pre-slotted) format?
+#define isLegacy(p)  (((p)->magic & 0xffff0000) != PAGE_MAGIC)
+// does p hold encoded tuples and a dictionary?
+#define isCompressed(p) \
+	(!isLegacy(p) && (((p)->magic >> 13) & PAGE_COMPRESSED))
+// does each tuple record start with the tuple's hash?
+#define isHashed(p) \
+	(!isLegacy(p) && (((p)->magic >> 13) & PAGE_HASHED))
+#define hashBytes(p) (isHashed(p) ? sizeof(Bits) : 0)
+// first slot that can hold a tuple
+#define firstSlot(p) (isCompressed(p) ? 1 : 0)
+// start and size of the record in slot s
+#define record(p,s)  ((Byte *)(p) + (p)->slot[s].off)
+#define recBytes(p,s) ((p)->slot[s].len + 1)
+// start and size of the tuple (plain or encoded) in record s
+#define tupRec(p,s)  (record(p,s) + hashBytes(p))
+#define tupBytes(p,s) (recBytes(p,s) - hashBytes(p))
+
+// Helpers
+static Count liveBytes(Page p);
+static Count freeSlot(Page p);
+static void placeRecord(Page p, Count s, Byte *rec, Count n);
+static void squeezePage(Page p);
+static void packDict(Page p);
+static Count dictOff(Byte *dict, Count i);
+static int dictFind(Byte *dict, char *val, Count len);
+static int dictAdd(Byte *dict, char *val, Count len);
+static Count encodeTuple(Tuple t, Byte *rec, Byte *dict, Bool grow);
+static Tuple decodeTuple(Page p, Count s, char *buf);
 
-// create a new initially empty page in memory
-Page newPage()
+// is size a valid page size?
+Bool validPageSize(Count size)
 {
-	Page p = malloc(PAGESIZE);
-	assert(p != NULL);
-	p->free = 0;
+	if (size < MINPAGESIZE || size > MAXPAGESIZE) return FALSE;
+	return (size & (size-1)) == 0;
+}
+
+// initialise a buffer of size bytes as an empty page
+// flags selects the page format (PAGE_* flags, or 0)
+void initPage(Page p, Count size, Count flags)
+{
+	assert(validPageSize(size));
+	Count lg = 0;
+	while ((1u << lg) < size) lg++;
+	memset(p, 0, size);
+	p->magic = PAGE_MAGIC | (flags << 13) | (lg << 8) | PAGE_VERSION;
 	p->ovflow = NO_PAGE;
 	p->ntuples = 0;
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	int dataSize = PAGESIZE - hdr_size;
-	memset(p->data, 0, dataSize);
-	return p;
+	p->nslots = 0;
+	p->upper = size;
+	if (flags & PAGE_COMPRESSED) {
+		// empty dictionary
+		Byte dict[3] = { 0 };
+		unsigned short off = sizeof(dict);
+		memcpy(dict+1, &off, sizeof(off));
+		placeRecord(p, 0, dict, sizeof(dict));
+	}
 }
 
-// append a new Page to a file; return its PageID
-PageID addPage(FILE *f)
+// append a new empty Page to a file; return its PageID
+PageID addPage(FILE *f, Count size, Count flags)
 {
 	int ok = fseek(f, 0, SEEK_END);
 	assert(ok == 0);
-	int pos = ftell(f);
+	long pos = ftell(f);
 	assert(pos >= 0);
-	PageID pid = pos/PAGESIZE;
-	Page p = newPage();
-	ok = putPage(f, pid, p);
-	assert(ok == 0);
+	PageID pid = pos/size;
+	Offset buf[size/sizeof(Offset)];
+	initPage((Page)buf, size, flags);
+	writePage(f, pid, (Page)buf, size);
 	return pid;
 }
 
-// fetch a Page from a file; allocate a memory buffer
-Page getPage(FILE *f, PageID pid)
+// read a Page from a file into a buffer of size bytes
+void readPage(FILE *f, PageID pid, Page p, Count size)
 {
-	assert(pid >= 0);
-	Page p = malloc(PAGESIZE);
-	assert(p != NULL);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
+	assert(pid != NO_PAGE);
+	int ok = fseek(f, (long)pid*size, SEEK_SET);
 	assert(ok == 0);
-	int n = fread(p, 1, PAGESIZE, f);
-	assert(n == PAGESIZE);
-	return p;
+	Count n = fread(p, 1, size, f);
+	assert(n == size);
 }
 
-// write a Page to a file; release allocated buffer
-Status putPage(FILE *f, PageID pid, Page p)
+// write a buffer of size bytes to a Page in a file
+void writePage(FILE *f, PageID pid, Page p, Count size)
 {
-	assert(pid >= 0);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
+	assert(pid != NO_PAGE);
+	int ok = fseek(f, (long)pid*size, SEEK_SET);
 	assert(ok == 0);
-	int n = fwrite(p, 1, PAGESIZE, f);
-	assert(n == PAGESIZE);
-	free(p);
-	return 0;
+	Count n = fwrite(p, 1, size, f);
+	assert(n == size);
 }
 
 // insert a tuple into a page
+// h is the tuple's hash, which is only kept in PAGE_HASHED pages
 // returns 0 status if successful
 // returns -1 if not enough room
-Status addToPage(Page p, Tuple t)
-{
-	int n = tupLength(t);
-	char *c = p->data + p->free;
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	// doesn't fit ... return fail code
-	// assume caller will put it elsewhere
-	if (c+n > &p->data[PAGESIZE-hdr_size-2]) return -1;
-	strcpy(c, t);
-	p->free += n+1;
+Status addToPage(Page p, Tuple t, Bits h)
+{
+	// legacy pages are read-only
+	if (isLegacy(p)) return -1;
+	Count s = freeSlot(p);
+	Count need = (s == p->nslots) ? sizeof(Slot) : 0;
+	Byte rec[sizeof(Bits) + 2*MAXTUPLEN];
+	Count hb = hashBytes(p);
+	memcpy(rec, &h, hb);
+	if (!isCompressed(p)) {
+		Count n = hb + tupLength(t) + 1;
+		need += n;
+		// doesn't fit ... return fail code
+		// assume caller will put it elsewhere
+		if (need > pageFreeSpace(p)
+		    && need > pageFreeSpace(p) + pageSize(p) - p->upper - liveBytes(p))
+			return -1;
+		if (hb == 0)
+			placeRecord(p, s, (Byte *)t, n);
+		else {
+			memcpy(rec+hb, t, n-hb);
+			placeRecord(p, s, rec, n);
+		}
+		p->ntuples++;
+		return OK;
+	}
+	// encode, adding the tuple's new values to a copy of the dictionary
+	Byte *dict = record(p,0);
+	Count dlen = recBytes(p,0);
+	Byte *newdict = malloc(dlen + 2*MAXTUPLEN);
+	memcpy(newdict, dict, dlen);
+	Count n = hb + encodeTuple(t, rec+hb, newdict, TRUE);
+	Count newdlen = dictOff(newdict, newdict[0]);
+	Count room = pageFreeSpace(p);
+	if (need + n + newdlen - dlen > room)
+		room += pageSize(p) - p->upper - liveBytes(p);
+	if (need + n + newdlen - dlen > room) {
+		// no room to grow the dictionary; store new values as literals
+		n = hb + encodeTuple(t, rec+hb, dict, FALSE);
+		newdlen = dlen;
+		if (need + n > room) { free(newdict); return -1; }
+	}
+	if (newdlen != dlen) placeRecord(p, 0, newdict, newdlen);
+	free(newdict);
+	placeRecord(p, s, rec, n);
 	p->ntuples++;
 	return OK;
 }
 
+// fetch the tuple in slot s, or NULL if slot s holds no tuple
+// tuples in compressed pages are decoded into buf (MAXTUPLEN chars);
+// otherwise the tuple points into the page (don't free or modify it)
+Tuple pageTuple(Page p, Count s, char *buf)
+{
+	if (isLegacy(p)) {
+		LegacyPage *lp = (LegacyPage *)p;
+		if (s >= lp->ntuples) return NULL;
+		char *c = lp->data;
+		while (s-- > 0) c += strlen(c) + 1;
+		return c;
+	}
+	if (s < firstSlot(p) || s >= p->nslots || p->slot[s].off == 0)
+		return NULL;
+	if (isCompressed(p)) return decodeTuple(p, s, buf);
+	return (char *)tupRec(p,s);
+}
+
+// scan the live tuples in a page
+// *pos is a cursor, which should be set to 0 before the first call
+// buf is as for pageTuple()
+// returns NULL after the last tuple
+Tuple pageNextTuple(Page p, Count *pos, char *buf)
+{
+	if (isLegacy(p)) {
+		// cursor is #tuples seen so far and the offset of the next one
+		LegacyPage *lp = (LegacyPage *)p;
+		Count seen = *pos >> 16, off = *pos & 0xffff;
+		if (seen >= lp->ntuples) return NULL;
+		char *c = lp->data + off;
+		off += strlen(c) + 1;
+		*pos = ((seen+1) << 16) | off;
+		return c;
+	}
+	// cursor is the next slot to look at
+	if (*pos < firstSlot(p)) *pos = firstSlot(p);
+	while (*pos < p->nslots) {
+		Count s = (*pos)++;
+		if (p->slot[s].off == 0) continue;
+		if (isCompressed(p)) return decodeTuple(p, s, buf);
+		return (char *)tupRec(p,s);
+	}
+	return NULL;
+}
+
+// remove the tuple in slot s from a page
+// the space is reclaimed by compactPage()
+Status deleteFromPage(Page p, Count s)
+{
+	if (isLegacy(p) || s < firstSlot(p) || s >= p->nslots
+	    || p->slot[s].off == 0)
+		return -1;
+	if (p->slot[s].off == p->upper)
+		p->upper += recBytes(p,s);
+	p->slot[s].off = 0;
+	p->slot[s].len = 0;
+	p->ntuples--;
+	// trailing unused slots can go
+	while (p->nslots > 0 && p->slot[p->nslots-1].off == 0)
+		p->nslots--;
+	return OK;
+}
+
+// squeeze out space left by deleted tuples (and, in compressed
+// pages, by dictionary entries no tuple uses any more)
+// live tuples keep their slot numbers
+void compactPage(Page p)
+{
+	if (isLegacy(p)) return;
+	if (isCompressed(p)) packDict(p);
+	squeezePage(p);
+}
+
+// dictionary code for value val in a compressed page
+// returns -1 if val is not in the page's dictionary
+// (or the page is not compressed)
+int pageDictCode(Page p, char *val)
+{
+	if (!isCompressed(p)) return -1;
+	return dictFind(record(p,0), val, strlen(val));
+}
+
+// could the tuple in slot s of a compressed page match a query?
+// vals[i] is the value wanted for attribute i (NULL = don't care)
+// and codes[i] is pageDictCode(p, vals[i])
+// compares the encoded tuple, without decoding it
+Bool pageMatchEncoded(Page p, Count s, char **vals, int *codes, Count nvals)
+{
+	if (s < firstSlot(p) || s >= p->nslots || p->slot[s].off == 0)
+		return FALSE;
+	if (!isCompressed(p)) return TRUE;
+	Byte *c = tupRec(p,s), *end = c + tupBytes(p,s);
+	for (Count i = 0; i < nvals && c < end; i++) {
+		if (*c != LITERAL) {
+			if (vals[i] != NULL && codes[i] != *c) return FALSE;
+			c++;
+			continue;
+		}
+		Count len = c[1];
+		if (vals[i] != NULL
+		    && (strlen(vals[i]) != len || memcmp(vals[i], c+2, len) != 0))
+			return FALSE;
+		c += 2 + len;
+	}
+	return TRUE;
+}
+
+// the hash stored with the tuple in slot s of a PAGE_HASHED page
+// (0 if the slot is empty or the page keeps no hashes)
+Bits pageTupleHash(Page p, Count s)
+{
+	Bits h = 0;
+	if (isHashed(p) && s >= firstSlot(p) && s < p->nslots
+	    && p->slot[s].off != 0)
+		memcpy(&h, record(p,s), sizeof(Bits));
+	return h;
+}
+
+// the record heap of a plain (or PAGE_HASHED) page: the records of
+// its tuples, each tuple '\0'-terminated, and of any tuples deleted
+// since it was last compacted
+// returns its size and sets *start, or returns 0 for compressed and
+// legacy pages, whose records aren't tuples
+Count pageRecords(Page p, char **start)
+{
+	if (isLegacy(p) || isCompressed(p)) return 0;
+	*start = (char *)p + p->upper;
+	return pageSize(p) - p->upper;
+}
+
 // extract page info
-char *pageData(Page p) { return p->data; }
+Bool pageIsLegacy(Page p) { return isLegacy(p); }
+Bool pageIsCompressed(Page p) { return isCompressed(p); }
+Bool pageIsHashed(Page p) { return isHashed(p); }
+Count pageSize(Page p) {
+	if (isLegacy(p)) return LEGACYSIZE;
+	Count lg = (p->magic >> 8) & 0x1f;
+	return (lg == 0) ? PAGESIZE : (1u << lg);
+}
 Count pageNTuples(Page p) { return p->ntuples; }
+Count pageNSlots(Page p) {
+	return isLegacy(p) ? p->ntuples : p->nslots;
+}
 Offset pageOvflow(Page p) { return p->ovflow; }
 void pageSetOvflow(Page p, PageID pid) { p->ovflow = pid; }
 Count pageFreeSpace(Page p) {
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	return (PAGESIZE-hdr_size-p->free);
+	if (isLegacy(p))
+		return (LEGACYSIZE-LEGACYHDR-((LegacyPage *)p)->free);
+	return p->upper - HDRSIZE - p->nslots*sizeof(Slot);
+}
+
+// #bytes a tuple of len chars takes in an uncompressed page with
+// the given flags (record + slot)
+Count recordSpace(Count len, Count flags) {
+	Count n = len + 1 + sizeof(Slot);
+	return (flags & PAGE_HASHED) ? n + sizeof(Bits) : n;
+}
+
+// #bytes for tuples in an empty plain page of the given size
+Count pageCapacity(Count size) { return size - HDRSIZE; }
+
+// total bytes used by live records
+static Count liveBytes(Page p)
+{
+	Count n = 0;
+	for (Count s = 0; s < p->nslots; s++) {
+		if (p->slot[s].off != 0) n += recBytes(p,s);
+	}
+	return n;
+}
+
+// an unused slot, or p->nslots if the directory needs a new one
+static Count freeSlot(Page p)
+{
+	Count s = p->nslots;
+	if (p->ntuples + firstSlot(p) < p->nslots) {
+		for (s = firstSlot(p); s < p->nslots; s++) {
+			if (p->slot[s].off == 0) break;
+		}
+	}
+	return s;
+}
+
+// put an n-byte record in slot s, replacing any record already
+// there; s may be p->nslots, adding a slot to the directory
+// the caller has checked that the page has room for it
+static void placeRecord(Page p, Count s, Byte *rec, Count n)
+{
+	Count grow = 0;
+	if (s == p->nslots)
+		grow = sizeof(Slot);
+	else if (p->slot[s].off != 0) {
+		if (p->slot[s].off == p->upper) p->upper += recBytes(p,s);
+		p->slot[s].off = 0;
+	}
+	// enough space, but it's fragmented by deletions
+	if (n + grow > pageFreeSpace(p)) squeezePage(p);
+	assert(n + grow <= pageFreeSpace(p));
+	if (grow) p->slot[p->nslots++].off = 0;
+	p->upper -= n;
+	memcpy((char *)p + p->upper, rec, n);
+	p->slot[s].off = p->upper;
+	p->slot[s].len = n-1;
+}
+
+// move the live records together at the end of the page
+static void squeezePage(Page p)
+{
+	Count size = pageSize(p);
+	char buf[size];
+	Offset upper = size;
+	for (Count s = 0; s < p->nslots; s++) {
+		Slot *sl = &p->slot[s];
+		if (sl->off == 0) continue;
+		upper -= sl->len + 1;
+		memcpy(buf + upper, (char *)p + sl->off, sl->len + 1);
+		sl->off = upper;
+	}
+	Offset lower = HDRSIZE + p->nslots*sizeof(Slot);
+	memset((char *)p + lower, 0, upper - lower);
+	memcpy((char *)p + upper, buf + upper, size - upper);
+	p->upper = upper;
 }
 
+// drop dictionary entries that no tuple in the page uses,
+// renumbering the codes in the tuples that use the others
+static void packDict(Page p)
+{
+	Byte *dict = record(p,0);
+	Count nd = dict[0];
+	Count nref[MAXDICT] = { 0 };
+	for (Count s = 1; s < p->nslots; s++) {
+		if (p->slot[s].off == 0) continue;
+		Byte *c = tupRec(p,s), *end = c + tupBytes(p,s);
+		while (c < end) {
+			if (*c == LITERAL) { c += 2 + c[1]; continue; }
+			nref[*c++]++;
+		}
+	}
+	Byte code[MAXDICT];
+	Count nkeep = 0;
+	for (Count i = 0; i < nd; i++) {
+		if (nref[i] > 0) code[i] = nkeep++;
+	}
+	if (nkeep == nd) return;
+	for (Count s = 1; s < p->nslots; s++) {
+		if (p->slot[s].off == 0) continue;
+		Byte *c = tupRec(p,s), *end = c + tupBytes(p,s);
+		while (c < end) {
+			if (*c == LITERAL) { c += 2 + c[1]; continue; }
+			*c = code[*c];
+			c++;
+		}
+	}
+	// the new dictionary is smaller, so it is rebuilt in place
+	Byte newdict[dictOff(dict, nd)];
+	unsigned short off = 1 + 2*(nkeep+1);
+	newdict[0] = nkeep;
+	memcpy(newdict+1, &off, sizeof(off));
+	for (Count i = 0, k = 0; i < nd; i++) {
+		if (nref[i] == 0) continue;
+		Count len = dictOff(dict, i+1) - dictOff(dict, i);
+		memcpy(newdict + off, dict + dictOff(dict, i), len);
+		off += len;
+		k++;
+		memcpy(newdict+1+2*k, &off, sizeof(off));
+	}
+	memcpy(dict, newdict, off);
+	p->slot[0].len = off-1;
+}
+
+// offset within the dictionary of the start of entry i
+// (entry dict[0] is the end of the dictionary)
+static Count dictOff(Byte *dict, Count i)
+{
+	unsigned short off;
+	memcpy(&off, dict+1+2*i, sizeof(off));
+	return off;
+}
+
+// code of the dictionary entry holding the len chars in val
+// returns -1 if there is no such entry
+static int dictFind(Byte *dict, char *val, Count len)
+{
+	Count start = dictOff(dict, 0);
+	for (Count i = 0; i < dict[0]; i++) {
+		Count end = dictOff(dict, i+1);
+		if (end - start == len && memcmp(dict+start, val, len) == 0)
+			return i;
+		start = end;
+	}
+	return -1;
+}
+
+// append the len chars in val to a dictionary (which must not be
+// full and must have room for 2+len more bytes); returns its code
+static int dictAdd(Byte *dict, char *val, Count len)
+{
+	Count nd = dict[0];
+	Count start = dictOff(dict, 0), end = dictOff(dict, nd);
+	// make room for another offset
+	memmove(dict+start+2, dict+start, end-start);
+	for (Count i = 0; i <= nd; i++) {
+		unsigned short off = dictOff(dict, i) + 2;
+		memcpy(dict+1+2*i, &off, sizeof(off));
+	}
+	memcpy(dict+end+2, val, len);
+	unsigned short off = end + 2 + len;
+	memcpy(dict+1+2*(nd+1), &off, sizeof(off));
+	dict[0] = nd+1;
+	return nd;
+}
+
+// encode tuple t into rec using dictionary dict
+// if grow is set, values not in dict are added to it while it
+// has room (so dict needs 2*MAXTUPLEN spare bytes); otherwise they are
+// stored as literals; returns #bytes in the encoded record
+static Count encodeTuple(Tuple t, Byte *rec, Byte *dict, Bool grow)
+{
+	Count n = 0;
+	char *c = t;
+	for (;;) {
+		char *comma = strchr(c, ',');
+		Count len = (comma == NULL) ? strlen(c) : comma - c;
+		int code = dictFind(dict, c, len);
+		if (code < 0 && grow && dict[0] < MAXDICT
+		    && dictOff(dict, dict[0]) + 2 + len <= MAXDICTOFF)
+			code = dictAdd(dict, c, len);
+		if (code >= 0)
+			rec[n++] = code;
+		else {
+			rec[n++] = LITERAL;
+			rec[n++] = len;
+			memcpy(rec+n, c, len);
+			n += len;
+		}
+		if (comma == NULL) break;
+		c = comma + 1;
+	}
+	return n;
+}
+
+// decode the tuple in slot s of a compressed page into buf
+static Tuple decodeTuple(Page p, Count s, char *buf)
+{
+	Byte *dict = record(p,0);
+	Byte *c = tupRec(p,s), *end = c + tupBytes(p,s);
+	char *out = buf;
+	Bool first = TRUE;
+	while (c < end) {
+		if (!first) *out++ = ',';
+		first = FALSE;
+		if (*c == LITERAL) {
+			memcpy(out, c+2, c[1]);
+			out += c[1];
+			c += 2 + c[1];
+		}
+		else {
+			Count off = dictOff(dict, *c);
+			Count len = dictOff(dict, *c+1) - off;
+			memcpy(out, dict+off, len);
+			out += len;
+			c++;
+		}
+	}
+	*out = '\0';
+	return buf;
+}
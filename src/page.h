@@ -9,15 +9,34 @@ typedef struct PageRep *Page;
 #include "defs.h"
 #include "tuple.h"
 
-Page newPage();
-PageID addPage(FILE *);
-Page getPage(FILE *, PageID);
-Status putPage(FILE *, PageID, Page);
-Status addToPage(Page, Tuple);
-char *pageData(Page);
+// page format flags
+#define PAGE_COMPRESSED 0x1  // tuples are dictionary-encoded
+#define PAGE_HASHED     0x2  // each tuple is stored with its hash
+
+Bool validPageSize(Count);
+void initPage(Page, Count, Count);
+PageID addPage(FILE *, Count, Count);
+void readPage(FILE *, PageID, Page, Count);
+void writePage(FILE *, PageID, Page, Count);
+Status addToPage(Page, Tuple, Bits);
+Tuple pageTuple(Page, Count, char *);
+Tuple pageNextTuple(Page, Count *, char *);
+Status deleteFromPage(Page, Count);
+void compactPage(Page);
+int pageDictCode(Page, char *);
+Bool pageMatchEncoded(Page, Count, char **, int *, Count);
+Bool pageIsLegacy(Page);
+Bool pageIsCompressed(Page);
+Bool pageIsHashed(Page);
+Bits pageTupleHash(Page, Count);
+Count pageRecords(Page, char **);
+Count pageSize(Page);
 Count pageNTuples(Page);
+Count pageNSlots(Page);
 Offset pageOvflow(Page);
 void pageSetOvflow(Page, PageID);
 Count pageFreeSpace(Page);
+Count recordSpace(Count, Count);
+Count pageCapacity(Count);
 
 #endif
@@ -1,18 +1,54 @@
 // query.c ... run queries
 // Ask a query on a named relation
-// Usage:  ./query  [-v]  'a1,a3,..'  from  RelName where 'v1,v2,v3,v4,...'
+// Usage:  ./query  [-v]  [-p N]  [-j N [-u]]  'a1,a3,..'  from  RelName where 'v1,v2,v3,v4,...'
 // - a1,a3,... can be '*' to indicate all attributes
 // - Any vi can be '?' to indicate an unknown value
 // - Any vi can contain '%' as a wildcard matching zero or more characters
+// - -p N reads up to N buckets ahead of the scan (0 turns prefetching off)
+// - -j N scans the buckets in N threads; tuples come out in bucket order,
+//   as without -j, unless -u lets each thread print them as it finds them
 
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
 #include "defs.h"
 #include "select.h"
 #include "project.h"
 #include "tuple.h"
 #include "reln.h"
 #include "chvec.h"
+#include "queue.h"
 
-#define USAGE "./query  [-v]  a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,..."
+#define USAGE "./query  [-v]  [-p N]  [-j N [-u]]  a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,..."
+
+// With -j N, scanner k scans buckets k, k+N, k+2N, ... of the selection
+// (in a fork of it, see forkSelection) and projects the tuples it finds
+// into chunks of output
+// - in bucket order, each chunk holds one bucket and goes to the main
+//   thread through the scanner's queue; the main thread takes bucket b
+//   from scanner b%N, so it prints them in order (as insert -j does)
+// - unordered (-u), scanners write chunks to stdout as they fill up
+
+#define MAXSCANNERS 64
+#define QUEUELEN    8      // buckets in flight from each scanner
+#define CHUNKSIZE   65536  // output that -u collects before writing
+
+typedef struct {
+	size_t len;      // #chars of output
+	size_t size;     // #chars of room in text
+	char  *text;     // projected tuples, one per line
+} Chunk;
+
+typedef struct {
+	Selection  s;    // this scanner's fork of the selection
+	Projection p;    // shared; projectTuple doesn't change it
+	Count      id;   // which scanner this is
+	Count      n;    // number of scanners
+	Queue      out;  // chunks for the main thread (NULL for -u)
+} Scanner;
+
+static void parallelQuery(Selection s, Projection p, int n, int ordered);
+static void *scanStage(void *arg);
+static Chunk *newChunk(void);
 
 // Main ... process args, run query
 
@@ -23,19 +59,37 @@ int main(int argc, char **argv)
 	Projection p;  // handle on the projection
 	Tuple t;  // tuple pointer
 	char err[MAXERRMSG];  // buffer for error messages
-	int offset = 0; // adapt offset for -v
+	int offset = 0; // adapt offset for options
 	int verbose = 0;  // show extra info on query progress
+	int prefetch = PREFETCH;  // buckets to read ahead
+	int nscan = 0;  // scanning threads (0 = scan in this one)
+	int ordered = 1;  // print tuples in bucket order with -j
 	char *rname;  // name of table/file
 	char *valstr;   // a query string of values for selection
 	char *attrstr;   // string of 1-based attribute indexes used for projection
 
 	// process command-line args
 
-	if (argc < 6 || argc > 7) fatal(USAGE);
-	if (strcmp(argv[1], "-v") == 0) {
-		if (argc != 7) fatal(USAGE);
-		offset = 1;  verbose = 1;
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0) {
+			offset += 1;  verbose = 1;
+		}
+		else if (strcmp(argv[offset+1], "-p") == 0 && offset+2 < argc) {
+			if (!convert(argv[offset+2], &prefetch)) fatal(USAGE);
+			offset += 2;
+		}
+		else if (strcmp(argv[offset+1], "-j") == 0 && offset+2 < argc) {
+			if (!convert(argv[offset+2], &nscan)) fatal(USAGE);
+			if (nscan < 1 || nscan > MAXSCANNERS) fatal(USAGE);
+			offset += 2;
+		}
+		else if (strcmp(argv[offset+1], "-u") == 0) {
+			offset += 1;  ordered = 0;
+		}
+		else
+			fatal(USAGE);
 	}
+	if (argc != offset+6) fatal(USAGE);
 	if (strcmp(argv[offset+2], "from") != 0 || strcmp(argv[offset+4], "where") != 0) {
         fatal(USAGE);
     }
@@ -48,7 +102,7 @@ int main(int argc, char **argv)
 		sprintf(err, "No such relation: %s",rname);
 		fatal(err);
 	}
-	if ((r = openRelation(rname,"r")) == NULL) {
+	if ((r = openRelation(rname,"rm")) == NULL) {
 		sprintf(err, "Can't open relation: %s",rname);
 		fatal(err);
 	}
@@ -56,6 +110,7 @@ int main(int argc, char **argv)
 		sprintf(err, "Invalid selection: %s",valstr);
 		fatal(err);
 	}
+	setPrefetch(s, prefetch);
 	if ((p = startProjection(r, attrstr)) == NULL) {	
 		sprintf(err, "Invalid projection: %s",attrstr);
 		fatal(err);
@@ -63,10 +118,14 @@ int main(int argc, char **argv)
 
 	// execute the query (find matching tuples and project on specified attributes)
 
-	char tup[MAXTUPLEN];
-	while ((t = getNextTuple(s)) != NULL) {
-		projectTuple(p,t,tup);
-		printf("%s\n",tup);
+	if (nscan > 0)
+		parallelQuery(s, p, nscan, ordered);
+	else {
+		char tup[MAXTUPLEN];
+		while ((t = getNextTuple(s)) != NULL) {
+			projectTuple(p,t,tup);
+			printf("%s\n",tup);
+		}
 	}
 
 	// clean up
@@ -77,3 +136,85 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+
+// run the query in n scanning threads
+
+static void parallelQuery(Selection s, Projection p, int n, int ordered)
+{
+	Scanner scanners[MAXSCANNERS];
+	pthread_t threads[MAXSCANNERS];
+	for (int i = 0; i < n; i++) {
+		Scanner sc = { forkSelection(s), p, i, n,
+		               ordered ? newQueue(QUEUELEN) : NULL };
+		scanners[i] = sc;
+	}
+	for (int i = 0; i < n; i++) {
+		if (pthread_create(&threads[i], NULL, scanStage, &scanners[i]) != 0)
+			fatal("Can't start query threads");
+	}
+	if (ordered) {
+		int nb = selectionBuckets(s);
+		for (int b = 0; b < nb; b++) {
+			Chunk *c = getQueue(scanners[b % n].out);
+			fwrite(c->text, 1, c->len, stdout);
+			free(c->text);
+			free(c);
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		closeSelection(scanners[i].s);
+		if (ordered) freeQueue(scanners[i].out);
+	}
+}
+
+// scan this scanner's buckets, projecting the tuples found into
+// chunks of output
+
+static void *scanStage(void *arg)
+{
+	Scanner *sc = arg;
+	Selection s = sc->s;
+	int nb = selectionBuckets(s);
+	Chunk *c = newChunk();
+	for (int b = sc->id; b < nb; b += sc->n) {
+		Tuple t;
+		selectBucket(s, b);
+		while ((t = getNextTuple(s)) != NULL) {
+			if (c->size - c->len < MAXTUPLEN+1) {
+				c->size *= 2;
+				c->text = realloc(c->text, c->size);
+				assert(c->text != NULL);
+			}
+			projectTuple(sc->p, t, c->text + c->len);
+			c->len += strlen(c->text + c->len);
+			c->text[c->len++] = '\n';
+		}
+		if (sc->out != NULL) {
+			putQueue(sc->out, c);
+			c = newChunk();
+		}
+		else if (c->len >= CHUNKSIZE) {
+			// stdio locks stdout, so a chunk is written whole
+			fwrite(c->text, 1, c->len, stdout);
+			c->len = 0;
+		}
+	}
+	if (sc->out == NULL) fwrite(c->text, 1, c->len, stdout);
+	free(c->text);
+	free(c);
+	return NULL;
+}
+
+// an empty chunk of output
+
+static Chunk *newChunk(void)
+{
+	Chunk *c = malloc(sizeof(Chunk));
+	assert(c != NULL);
+	c->len = 0;
+	c->size = 4*MAXTUPLEN;
+	c->text = malloc(c->size);
+	assert(c->text != NULL);
+	return c;
+}
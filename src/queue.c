@@ -0,0 +1,83 @@
+// queue.c ... bounded queues between threads
+// Passes pointers from one producer thread to one consumer thread
+
+#define _POSIX_C_SOURCE 200809L
+#include <sched.h>
+#include "defs.h"
+#include "queue.h"
+
+// A Queue is a ring of size slots (size a power of 2)
+// - only the producer advances tail, only the consumer advances head,
+//   so no locks are needed; each index is published with a release
+//   store and read with an acquire load, which also orders the slot
+//   contents
+// - the two indexes are kept on separate cache lines, so the two
+//   threads don't keep stealing the line from each other
+// - a full (or empty) queue makes the producer (or consumer) spin
+//   for a while and then yield the CPU until the other side catches up
+
+#define CACHELINE 64
+#define SPINS     100
+
+struct QueueRep {
+	Count  head;       // next slot to take (consumer)
+	char   pad1[CACHELINE-sizeof(Count)];
+	Count  tail;       // next slot to fill (producer)
+	char   pad2[CACHELINE-sizeof(Count)];
+	Count  mask;       // size-1
+	void **items;
+};
+
+// make a queue holding up to size items
+
+Queue newQueue(Count size)
+{
+	assert(size > 0 && (size & (size-1)) == 0);
+	Queue q = malloc(sizeof(struct QueueRep));
+	assert(q != NULL);
+	q->head = q->tail = 0;
+	q->mask = size-1;
+	q->items = malloc(size*sizeof(void *));
+	assert(q->items != NULL);
+	return q;
+}
+
+// free a queue; any items still in it are the caller's business
+
+void freeQueue(Queue q)
+{
+	free(q->items);
+	free(q);
+}
+
+static void backOff(int *spins)
+{
+	if (++*spins < SPINS) return;
+	sched_yield();
+	*spins = 0;
+}
+
+// add an item at the tail, waiting while the queue is full
+
+void putQueue(Queue q, void *item)
+{
+	Count tail = q->tail;
+	int spins = 0;
+	while (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > q->mask)
+		backOff(&spins);
+	q->items[tail & q->mask] = item;
+	__atomic_store_n(&q->tail, tail+1, __ATOMIC_RELEASE);
+}
+
+// take the item at the head, waiting while the queue is empty
+
+void *getQueue(Queue q)
+{
+	Count head = q->head;
+	int spins = 0;
+	while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+		backOff(&spins);
+	void *item = q->items[head & q->mask];
+	__atomic_store_n(&q->head, head+1, __ATOMIC_RELEASE);
+	return item;
+}
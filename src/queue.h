@@ -0,0 +1,16 @@
+// queue.h ... interface to bounded queues between threads
+// See queue.c for details of Queue type and functions
+
+#ifndef QUEUE_H
+#define QUEUE_H 1
+
+typedef struct QueueRep *Queue;
+
+#include "defs.h"
+
+Queue newQueue(Count size);
+void freeQueue(Queue q);
+void putQueue(Queue q, void *item);
+void *getQueue(Queue q);
+
+#endif
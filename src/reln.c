@@ -1,53 +1,259 @@
 // reln.c ... functions on Relations
 
+#define _POSIX_C_SOURCE 200809L
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
 #include "defs.h"
 #include "reln.h"
 #include "page.h"
+#include "buffer.h"
+#include "wal.h"
 #include "tuple.h"
 #include "chvec.h"
 #include "bits.h"
 #include "hash.h"
+#include "match.h"
 
 #define HEADERSIZE (3*sizeof(Count)+sizeof(Offset))
 
+// Layout of the .info file
+// - INFO_MAGIC, #header words, header words, choice vector, tails
+// - header words are nattrs, depth, sp, npages, ntups, pagesize,
+//   freeov, nfree, flags, ntails, fill, nbytes, hashid, gen,
+//   nbytes high (nbytes is 64 bits; older files kept only the low
+//   word, with 0xffffffff meaning not known), minpages
+// - tails is ntails (last page, free bytes) pairs, one per bucket
+//   (see Tail below); ntails is 0 if they weren't saved
+// - a file with fewer header words was written by an older
+//   version; the missing words take default values
+// - legacy files (whose pages are not slotted) have no magic
+//   and no count: just nattrs, depth, sp, npages, ntups, cv
+#define INFO_MAGIC 0x484c414d
+
+// Each bucket's last page, so inserts can go straight to it
+// - kept in memory while the relation is open, saved in .info
+// - rebuilt by walking every chain when it is missing, e.g. after
+//   recovery from the write-ahead log or a vacuum
+typedef struct {
+	PageID last;   // last page in ovflow chain (NO_PAGE = primary page)
+	Count  free;   // #free bytes in the last page
+} Tail;
+#define NINFO      16
+#define NO_BYTES   UINT64_MAX  // nbytes not known (older .info)
+
 struct RelnRep {
+	char  *name;   // name of relation (prefix of its file names)
 	Count  nattrs; // number of attributes
 	Count  depth;  // depth of main data file
 	Offset sp;     // split pointer
     Count  npages; // number of main data pages
     Count  ntups;  // total number of tuples
+	Count  pagesize; // #bytes in each data/ovflow page
+	PageID freeov; // first page in ovflow free list
+	Count  nfree;  // #pages in ovflow free list
+	Count  flags;  // format of new pages (PAGE_* flags)
+	Count  fill;   // target load, as a percentage of data page capacity
+	uint64_t nbytes; // space all tuples need uncompressed (recordSpace)
+	Count  hashid; // hash function for attributes (HASH_* in hash.h)
+	Count  gen;    // generation of the data and ovflow files (see pageFile)
+	Count  minpages; // #pages it was created with; it never contracts below
 	ChVec  cv;     // choice vector
+	HashPlan plan; // cv compiled for tupleHash (see chvec.c)
+	Tail  *tails;  // last page of each bucket (NULL = not known)
+	Count  maxtails; // #entries allocated in tails[]
+	Page   spare;  // scratch page for splitBucket (NULL until needed)
 	char   mode;   // open for read/write
 	FILE  *info;   // handle on info file
 	FILE  *data;   // handle on data file
 	FILE  *ovflow; // handle on ovflow file
+	BufPool pool;  // buffer pool shared by data and ovflow pages
+	Wal    wal;    // write-ahead log (NULL if none)
+	Count  nbatch; // #inserts since last commit
+	Bool  legacy;  // stored in legacy (pre-slotted) pages?
+	Bool  shadow;  // being built by a reorganisation (see shadowRelation)
 	int   split;   // count splits for debugging;
 };
 
+// The file grows (one split at a time) to keep its load factor,
+// nbytes / (npages * pageCapacity), at or below fill percent
+// - nbytes is what the tuples would occupy uncompressed, so it
+//   depends only on the tuples, not on where they are stored; the
+//   number of pages for a given set of tuples is fixed (see
+//   pagesFor), which is what lets loadRelation work it out upfront
+// - compressed pages hold more than that, so their chains are shorter
+// - relations from before nbytes was kept get it counted on their
+//   first insert
+
+// Deletes and updates work bucket by bucket (see changeBucket)
+// - each page is compacted in place once its matching tuples are
+//   gone, and overflow pages left empty are unlinked and freed
+// - an updated tuple that still belongs in its bucket is rewritten
+//   in its page if it fits; otherwise it is inserted again at the end
+// - inserts only go to a bucket's last page, so once the space freed
+//   along a chain adds up to a page, the chain is repacked (see
+//   packBucket) and its emptied overflow pages are freed
+// - when the load factor falls below half of fill, the file
+//   contracts: the last bucket is merged back into its buddy,
+//   undoing the most recent split (see mergeBucket), but never
+//   below the #pages it was created with (e.g. presized by create -n)
+// - data pages dropped by merges stay in the file, and are reused
+//   if the file grows again; the file is never truncated, as
+//   readers may have it mapped (see mapFile), and vacuum drops them
+
+// The overflow file keeps a free list of pages that are no longer
+// part of any bucket's chain (e.g. released by splitBucket)
+// - free pages are empty and linked through their ovflow field
+// - its head and length are saved in the .info header
+// - newOvflowPage takes pages from it before growing the file
+// - vacuumRelation squeezes free pages out of the file
+
+// Changes are made durable through a write-ahead log (Rel.wal, one
+// per generation, see wal.c) rather than by writing pages and .info in place
+// - a writer sends pages written back by the buffer pool to the log
+// - every WALBATCH inserts, the pool's dirty pages and the header
+//   words are logged and the log is synced once (group commit)
+// - when the log holds WALCHECKPOINT pages, and at close, it is
+//   checkpointed: pages are copied home, .info is rewritten and
+//   the log is emptied
+// - openRelation replays whatever the log committed, so a crash
+//   loses at most the inserts since the last commit, and never
+//   leaves .info out of step with the pages
+
+// loadRelation builds a relation from scratch in one sequential pass
+// - every input tuple is hashed once, and the final depth and split
+//   pointer are those that inserting the tuples one at a time
+//   would have produced
+// - tuples are sorted by bucket (input order within a bucket), in
+//   memory if they fit in BULKMEM bytes, otherwise through a spill
+//   file split into runs of consecutive buckets
+// - each bucket's pages are then written in order: primary pages to
+//   the data file, and their overflow chains contiguously to the
+//   ovflow file
+// - Rel.load exists while the files are being rewritten; a relation
+//   with one left behind by a crash can't be opened
+// - the work is done by a Loader, which takes tuples with their
+//   hashes from loadRelation, or from anything else that has them
+//   (e.g. reorg, which hashes them in parallel)
+// - a Loader told upfront how many bytes it will get knows the
+//   final shape straight away, so if they don't fit in memory it
+//   partitions tuples into runs as they arrive, with no spill file
+
+typedef struct {
+	Bits   hash;   // tupleHash() of tuple
+	PageID bucket; // where it belongs once the load is complete
+	Count  seq;    // position in the input
+	Tuple  tuple;
+} LoadItem;
+#define LOADCHUNK  256  // tuples read and hashed together
+
+struct LoaderRep {
+	Reln   r;        // relation being loaded (empty until finished)
+	Count  ntups;    // #tuples added so far
+	uint64_t nbytes; // their recordSpace
+	size_t mem;      // memory they need as LoadItems
+	LoadItem *items; // tuples held in memory
+	Count  nitems;   // #entries used in items[]
+	Count  size;     // #entries allocated in items[]
+	FILE  *spill;    // every tuple, once they don't fit (shape unknown)
+	Count  np;       // #data pages after the load (0 = not known yet)
+	Count  d;        // depth after the load
+	Offset sp;       // split pointer after the load
+	Count  nruns;    // #runs of consecutive buckets
+	FILE **runs;     // tuples partitioned by bucket (NULL = in memory)
+};
+
+// A relation is reorganised under a new choice vector by building
+// a shadow copy in new files and swapping it in
+// - the reorganiser holds the relation open for writing, so other
+//   writers wait for its log lock until the swap
+// - the shadow's data, ovflow and log files belong to the next
+//   generation (Rel.data.1, Rel.ovflow.1, Rel.wal.1, see pageFile)
+//   and its .info is written to Rel.info.tmp; it has the same number
+//   of pages, depth and split pointer, and is filled by a Loader
+// - the old generation's log is not emptied at the swap, as readers
+//   of the old files may be reading it too; it is unlinked with them
+// - renaming Rel.info.tmp to Rel.info is the swap: a relation opened
+//   before it keeps reading the old generation's files, which are
+//   unlinked straight after; one opened after it gets the new files
+// - openRelation starts again if the files named by the .info it
+//   read vanish in between, or (for a writer) if .info has been
+//   replaced by the time it holds the log lock, as a writer that
+//   waited for the reorganiser to let the lock go would otherwise
+//   update files that are about to be unlinked
+// - the directory is synced after the rename, so a crash can't
+//   leave the old .info naming files that were removed
+// - a crash before the swap leaves the relation as it was
+
 // Helpers
-int capacity(Reln r);
+static Bool overFull(Reln r);
+static Bool underFull(Reln r);
+static void mergeBucket(Reln r);
+static Count changeBucket(Reln r, PageID b, Matcher m, Tuple set,
+                          Tuple **moved, Count *nmoved);
+static void packBucket(Reln r, PageID b, Count nchain);
+static Count pagesFor(Reln r, uint64_t nbytes);
+static void countBytes(Reln r);
+static PageID bucketFor(Bits h, Count depth, Offset sp);
+static PageID insertTuple(Reln r, Tuple t, Bits h);
+static void putLoadItem(FILE *f, LoadItem *it);
+static Bool getLoadItem(FILE *f, LoadItem *it);
+static int cmpLoadItem(const void *a, const void *b);
+static Bool openLog(Reln r, char *name);
+static Bool infoReplaced(Reln r);
+static void syncDir(char *name);
+static void checkpointRelation(Reln r);
+static void infoWords(Reln r, Count *hdr);
+static Status addToBucket(Reln r, PageID b, Tuple t, Bits h);
+static void growTails(Reln r);
+static void findTails(Reln r);
+static void setInfoWords(Reln r, Count *hdr);
 void splitBucket(Reln r);
+static Page newOvflowPage(Reln r, PageID *pid);
+static void freeOvflowPage(Reln r, PageID pid);
+static void readInfo(Reln r);
+static void writeInfo(Reln r, FILE *f);
+static void pageFile(char *buf, char *name, char *kind, Count gen);
+static void loaderShape(Loader ld, uint64_t nbytes);
+static void openRuns(Loader ld, size_t mem);
 // create a new relation (three files)
 
-Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv)
+Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv,
+                   Count pagesize, Count flags, Count fill, Count hashid)
 {
     char fname[MAXFILENAME];
 	Reln r = malloc(sizeof(struct RelnRep));
-	r->nattrs = nattrs; r->depth = d; r->sp = 0;
-	r->npages = npages; r->ntups = 0; r->mode = 'w';
 	assert(r != NULL);
+	r->name = copyString(name);
+	r->nattrs = nattrs; r->depth = d; r->sp = npages - (1 << d);
+	r->npages = npages; r->ntups = 0; r->mode = 'w';
+	r->pagesize = pagesize; r->legacy = FALSE;
+	r->freeov = NO_PAGE; r->nfree = 0; r->flags = flags;
+	r->fill = fill; r->nbytes = 0; r->hashid = hashid;
+	r->gen = 0; r->minpages = npages; r->shadow = FALSE;
+	r->wal = NULL; r->nbatch = 0;
+	r->tails = NULL; r->maxtails = 0;
+	r->spare = NULL;
 	if (parseChVec(r, cv, r->cv) != OK) return ~OK;
+	compileHashPlan(r->cv, hashFunction(hashid), &r->plan);
 	sprintf(fname,"%s.info",name);
 	r->info = fopen(fname,"w");
 	assert(r->info != NULL);
-	sprintf(fname,"%s.data",name);
+	pageFile(fname, name, "data", r->gen);
 	r->data = fopen(fname,"w");
 	assert(r->data != NULL);
-	sprintf(fname,"%s.ovflow",name);
+	pageFile(fname, name, "ovflow", r->gen);
 	r->ovflow = fopen(fname,"w");
 	assert(r->ovflow != NULL);
+	// start with an empty log
+	pageFile(fname, name, "wal", r->gen);
+	FILE *wal = fopen(fname,"w");
+	assert(wal != NULL);
+	fclose(wal);
+	r->pool = newBufPool(BUFBYTES/pagesize, pagesize, flags);
 	int i;
-	for (i = 0; i < npages; i++) addPage(r->data);
+	for (i = 0; i < npages; i++) addPage(r->data, pagesize, flags);
 	closeRelation(r);
 	return 0;
 }
@@ -69,158 +275,1036 @@ Bool existsRelation(char *name)
 
 // set up a relation descriptor from relation name
 // open files, reads information from rel.info
+// mode "rm" opens read-only and memory-maps the data and ovflow files
+// anything committed in the write-ahead log is recovered (for
+// writers, it is checkpointed into the files straight away)
 
 Reln openRelation(char *name, char *mode)
 {
 	Reln r;
 	r = malloc(sizeof(struct RelnRep));
 	assert(r != NULL);
+	Bool mapped = (strcmp(mode,"rm") == 0);
+	if (mapped) mode = "r";
 	char fname[MAXFILENAME];
-	sprintf(fname,"%s.info",name);
-	r->info = fopen(fname,mode);
-	assert(r->info != NULL);
-	sprintf(fname,"%s.data",name);
-	r->data = fopen(fname,mode);
-	assert(r->data != NULL);
-	sprintf(fname,"%s.ovflow",name);
-	r->ovflow = fopen(fname,mode);
-	assert(r->ovflow != NULL);
-	// Naughty: assumes Count and Offset are the same size
-	int n = fread(r, sizeof(Count), 5, r->info);
-	assert(n == 5);
-	n = fread(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
-	assert(n == MAXCHVEC);
+	sprintf(fname,"%s.load",name);
+	if (access(fname, F_OK) == 0) {
+		char err[MAXERRMSG+MAXRELNAME];
+		sprintf(err, "A bulk load of relation %s was interrupted; "
+		             "re-create it and load it again", name);
+		fatal(err);
+	}
+	r->name = copyString(name);
+	r->shadow = FALSE;
 	r->mode = (mode[0] == 'w' || mode[1] =='+') ? 'w' : 'r';
+	for (;;) {
+		char err[MAXERRMSG+2*MAXFILENAME];
+		sprintf(fname,"%s.info",name);
+		r->info = fopen(fname,mode);
+		if (r->info == NULL) {
+			sprintf(err, "Can't open %s", fname);
+			fatal(err);
+		}
+		readInfo(r);
+		pageFile(fname, name, "data", r->gen);
+		r->data = fopen(fname,mode);
+		if (r->data != NULL) {
+			pageFile(fname, name, "ovflow", r->gen);
+			r->ovflow = fopen(fname,mode);
+		}
+		if (r->data == NULL || r->ovflow == NULL) {
+			// the files are only missing if a reorganisation swapped
+			// in a new .info since this one was read
+			if (!infoReplaced(r)) {
+				sprintf(err, "Can't open %s", fname);
+				fatal(err);
+			}
+			if (r->data != NULL) fclose(r->data);
+			fclose(r->info);
+			free(r->tails);
+			continue;
+		}
+		if (r->legacy && r->mode == 'w') {
+			sprintf(err, "Relation %s uses the old page format; "
+			             "run ./upgrade %s first", name, name);
+			fatal(err);
+		}
+		r->pool = newBufPool(BUFBYTES/r->pagesize, r->pagesize, r->flags);
+		if (mapped) {
+			// failure to map just leaves that file to the buffer pool
+			mapFile(r->pool, r->data);
+			mapFile(r->pool, r->ovflow);
+		}
+		if (openLog(r, name)) break;
+		// a reorganisation swapped in new files before the log lock
+		// could be had; nothing has been written to these ones
+		freeBufPool(r->pool);
+		fclose(r->info);
+		fclose(r->data);
+		fclose(r->ovflow);
+		free(r->tails);
+	}
 	return r;
 }
 
+// has .info been replaced (by swapRelation) since r's was opened?
+
+static Bool infoReplaced(Reln r)
+{
+	char iname[MAXFILENAME];
+	struct stat was, now;
+	sprintf(iname, "%s.info", r->name);
+	return fstat(fileno(r->info), &was) == 0 && stat(iname, &now) == 0
+	       && (now.st_ino != was.st_ino || now.st_dev != was.st_dev);
+}
+
+// make the renames and removals in the directory holding relation
+// name's files durable
+
+static void syncDir(char *name)
+{
+	char dir[MAXFILENAME];
+	strcpy(dir, name);
+	char *slash = strrchr(dir, '/');
+	if (slash == NULL)
+		strcpy(dir, ".");
+	else
+		slash[1] = '\0';
+	int fd = open(dir, O_RDONLY);
+	if (fd < 0 || fsync(fd) < 0)
+		fatal("Can't sync relation directory");
+	close(fd);
+}
+
 // release files and descriptor for an open relation
 // copy latest information to .info file
 
 void closeRelation(Reln r)
 {
+	// make everything durable and empty the log
+	if (r->mode == 'w' && r->wal != NULL) checkpointRelation(r);
+	// write back any pages still dirty in the buffer pool
+	freeBufPool(r->pool);
+	if (r->wal != NULL) closeWal(r->wal);
 	// make sure updated global data is put in info
-	// Naughty: assumes Count and Offset are the same size
-	if (r->mode == 'w') {
-		fseek(r->info, 0, SEEK_SET);
-		// write out core relation info (#attr,#pages,d,sp)
-		int n = fwrite(r, sizeof(Count), 5, r->info);
-		assert(n == 5);
-		// write out choice vector
-		n = fwrite(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
-		assert(n == MAXCHVEC);
-	}
+	else if (r->mode == 'w') writeInfo(r, r->info);
 	fclose(r->info);
 	fclose(r->data);
 	fclose(r->ovflow);
+	free(r->name);
+	free(r->tails);
+	free(r->spare);
 	free(r);
 }
 
+// read global relation data from the .info file
+
+static void readInfo(Reln r)
+{
+	// defaults for words missing from older headers
+	Count hdr[NINFO] = { 0, 0, 0, 0, 0, PAGESIZE, NO_PAGE, 0, 0, 0,
+	                     FILLFACTOR, 0xffffffff, HASH_JENKINS, 0, 0, 1 };
+	Count nhdr, magic;
+	int n = fread(&magic, sizeof(Count), 1, r->info);
+	assert(n == 1);
+	if (magic == INFO_MAGIC) {
+		r->legacy = FALSE;
+		n = fread(&nhdr, sizeof(Count), 1, r->info);
+		assert(n == 1 && nhdr <= NINFO);
+		n = fread(hdr, sizeof(Count), nhdr, r->info);
+		assert(n == nhdr);
+	}
+	else {
+		// no magic: the first word was nattrs
+		r->legacy = TRUE;
+		hdr[0] = magic;
+		n = fread(&hdr[1], sizeof(Count), 4, r->info);
+		assert(n == 4);
+		nhdr = 5;
+	}
+	// without a high word, nbytes 0xffffffff was not known
+	if (nhdr <= 14 && hdr[11] == 0xffffffff) hdr[14] = 0xffffffff;
+	setInfoWords(r, hdr);
+	assert(validPageSize(r->pagesize));
+	n = fread(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
+	assert(n == MAXCHVEC);
+	assert(r->hashid < NHASHES);
+	compileHashPlan(r->cv, hashFunction(r->hashid), &r->plan);
+	r->tails = NULL; r->maxtails = 0;
+	r->spare = NULL;
+	if (hdr[9] == r->npages && r->npages > 0) {
+		growTails(r);
+		n = fread(r->tails, sizeof(Tail), r->npages, r->info);
+		assert(n == r->npages);
+	}
+}
+
+// write global relation data to an .info file
+// always uses the current layout
+
+static void writeInfo(Reln r, FILE *f)
+{
+	Count hdr[2+NINFO] = { INFO_MAGIC, NINFO };
+	infoWords(r, &hdr[2]);
+	fseek(f, 0, SEEK_SET);
+	int n = fwrite(hdr, sizeof(Count), 2+NINFO, f);
+	assert(n == 2+NINFO);
+	// write out choice vector
+	n = fwrite(r->cv, sizeof(ChVecItem), MAXCHVEC, f);
+	assert(n == MAXCHVEC);
+	if (r->tails != NULL) {
+		n = fwrite(r->tails, sizeof(Tail), r->npages, f);
+		assert(n == r->npages);
+	}
+}
+
+// the header words of a relation, in .info order
+
+static void infoWords(Reln r, Count *hdr)
+{
+	hdr[0] = r->nattrs; hdr[1] = r->depth; hdr[2] = r->sp;
+	hdr[3] = r->npages; hdr[4] = r->ntups; hdr[5] = r->pagesize;
+	hdr[6] = r->freeov; hdr[7] = r->nfree; hdr[8] = r->flags;
+	hdr[9] = (r->tails == NULL) ? 0 : r->npages;
+	hdr[10] = r->fill; hdr[11] = (Count)r->nbytes; hdr[12] = r->hashid;
+	hdr[13] = r->gen; hdr[14] = r->nbytes >> 32; hdr[15] = r->minpages;
+}
+
+static void setInfoWords(Reln r, Count *hdr)
+{
+	r->nattrs = hdr[0]; r->depth = hdr[1]; r->sp = hdr[2];
+	r->npages = hdr[3]; r->ntups = hdr[4]; r->pagesize = hdr[5];
+	r->freeov = hdr[6]; r->nfree = hdr[7]; r->flags = hdr[8];
+	r->fill = hdr[10]; r->hashid = hdr[12]; r->gen = hdr[13];
+	r->nbytes = (uint64_t)hdr[14] << 32 | hdr[11];
+	r->minpages = hdr[15];
+}
+
+// attach the relation's write-ahead log, recovering what it committed
+// readers only need a log that has something in it
+// a writer holds the log's lock from here on; returns FALSE (with no
+// log attached) if a reorganisation replaced r's files before the
+// lock was taken, as then they are no longer the relation's
+
+static Bool openLog(Reln r, char *name)
+{
+	char fname[MAXFILENAME];
+	FILE *files[2] = { r->data, r->ovflow };
+	r->wal = NULL;
+	r->nbatch = 0;
+	if (r->legacy) return TRUE;
+	pageFile(fname, name, "wal", r->gen);
+	r->wal = openWal(fname, r->pagesize, files, 2, r->mode == 'w');
+	if (r->wal == NULL) return TRUE;
+	if (r->mode == 'w' && infoReplaced(r)) {
+		// the log went with the rest of its generation, and opening
+		// it may have made it again
+		closeWal(r->wal);
+		r->wal = NULL;
+		remove(fname);
+		return FALSE;
+	}
+	if (r->mode == 'w') {
+		// a writer that finished after readInfo may have rewritten
+		// .info in place; read it again now no other writer can
+		free(r->tails);
+		rewind(r->info);
+		readInfo(r);
+	}
+	useWal(r->pool, r->wal);
+	Count hdr[NINFO];
+	infoWords(r, hdr);
+	if (!walHeader(r->wal, hdr, NINFO)) return TRUE;
+	setInfoWords(r, hdr);
+	// the saved tails are from the last checkpoint
+	free(r->tails);
+	r->tails = NULL; r->maxtails = 0;
+	if (r->mode != 'w') return TRUE;
+	// bring the files up to date; data and ovflow pages added by
+	// batches that never committed are left unused at the end of
+	// the files (later splits reuse the data pages)
+	checkpointRelation(r);
+	return TRUE;
+}
+
+// make all inserts so far durable
+// logs the pool's dirty pages and the header, with one sync
+
+void commitRelation(Reln r)
+{
+	if (r->wal == NULL) return;
+	Count hdr[NINFO];
+	infoWords(r, hdr);
+	flushBufPool(r->pool);
+	walCommit(r->wal, hdr, NINFO);
+	r->nbatch = 0;
+	if (walNPages(r->wal) >= WALCHECKPOINT) checkpointRelation(r);
+}
+
+// copy everything committed into the relation's files and empty
+// the log; .info is synced before the log is truncated, so a
+// crash at any point leaves one of them complete
+
+static void checkpointRelation(Reln r)
+{
+	Count hdr[NINFO];
+	infoWords(r, hdr);
+	flushBufPool(r->pool);
+	walCommit(r->wal, hdr, NINFO);
+	walCheckpoint(r->wal);
+	writeInfo(r, r->info);
+	if (fflush(r->info) != 0 || fsync(fileno(r->info)) < 0)
+		fatal("Can't sync info file");
+	walTruncate(r->wal);
+	r->nbatch = 0;
+}
+
+// rewrite a relation stored in legacy pages in the current format
+// depth, split pointer, bucket contents and tuple order are kept;
+// the new files are built alongside and then renamed into place
+
+Status upgradeRelation(char *name)
+{
+	Reln r = openRelation(name, "r");
+	if (!r->legacy) {
+		closeRelation(r);
+		return OK;
+	}
+	char fname[MAXFILENAME], tname[MAXFILENAME];
+	char *suffix[3] = { "data", "ovflow", "info" };
+	FILE *out[3];
+	for (int i = 0; i < 3; i++) {
+		sprintf(tname, "%s.%s.tmp", name, suffix[i]);
+		out[i] = fopen(tname, "w");
+		if (out[i] == NULL) return ~OK;
+	}
+
+	Page pg, newpg = malloc(r->pagesize);
+	assert(newpg != NULL);
+	char buf[MAXTUPLEN];
+	PageID nextov = 0;  // next page in new ovflow file
+	for (PageID b = 0; b < r->npages; b++) {
+		// copy the bucket's tuples into a fresh chain
+		FILE *outf = out[0];
+		PageID outp = b;
+		initPage(newpg, r->pagesize, r->flags);
+		FILE *f = r->data;
+		PageID pid = b;
+		while (pid != NO_PAGE) {
+			pg = pinPage(r->pool, f, pid);
+			Count pos = 0;
+			Tuple t;
+			while ((t = pageNextTuple(pg, &pos, buf)) != NULL) {
+				Bits h = tupleHash(r, t);
+				if (addToPage(newpg, t, h) == OK) continue;
+				pageSetOvflow(newpg, nextov);
+				writePage(outf, outp, newpg, r->pagesize);
+				outf = out[1]; outp = nextov++;
+				initPage(newpg, r->pagesize, r->flags);
+				Status ok = addToPage(newpg, t, h);
+				assert(ok == OK);
+			}
+			pid = pageOvflow(pg);
+			unpinPage(r->pool, pg, FALSE);
+			f = r->ovflow;
+		}
+		writePage(outf, outp, newpg, r->pagesize);
+	}
+	free(newpg);
+	writeInfo(r, out[2]);
+	for (int i = 0; i < 3; i++) fclose(out[i]);
+	closeRelation(r);
+
+	// .info goes last, so the relation only looks upgraded once
+	// the new pages are all in place
+	for (int i = 0; i < 3; i++) {
+		sprintf(fname, "%s.%s", name, suffix[i]);
+		sprintf(tname, "%s.%s.tmp", name, suffix[i]);
+		if (rename(tname, fname) != 0) return ~OK;
+	}
+	return OK;
+}
+
+// compact the overflow file of a relation, dropping free pages
+// each bucket's overflow chain ends up in consecutive pages, in
+// bucket order; data pages left past the end of the file by merges
+// are dropped too
+// the pages are copied into the next generation's files, which are
+// swapped in as for a reorganisation, so a crash leaves either the
+// old relation or the new one, and queries can run throughout
+
+Status vacuumRelation(char *name)
+{
+	Reln r = openRelation(name, "r+");
+	Reln s = shadowRelation(r, NULL);
+	s->ntups = r->ntups; s->nbytes = r->nbytes;
+	s->npages = r->npages;
+	growTails(s);
+
+	Page pg = malloc(r->pagesize);
+	assert(pg != NULL);
+	PageID nextov = 0;  // next page in new ovflow file
+	for (PageID b = 0; b < r->npages; b++) {
+		// copy the chain; page k+1 of the chain follows page k
+		Page src = pinPage(r->pool, r->data, b);
+		memcpy(pg, src, r->pagesize);
+		unpinPage(r->pool, src, FALSE);
+		FILE *f = s->data;
+		PageID pid = b;
+		for (;;) {
+			PageID ovp = pageOvflow(pg);
+			pageSetOvflow(pg, (ovp == NO_PAGE) ? NO_PAGE : nextov);
+			writePage(f, pid, pg, r->pagesize);
+			if (ovp == NO_PAGE) break;
+			src = pinPage(r->pool, r->ovflow, ovp);
+			memcpy(pg, src, r->pagesize);
+			unpinPage(r->pool, src, FALSE);
+			f = s->ovflow;
+			pid = nextov++;
+		}
+		s->tails[b].last = (f == s->data) ? NO_PAGE : pid;
+		s->tails[b].free = pageFreeSpace(pg);
+	}
+	free(pg);
+
+	// the new pages are durable before .info describes them
+	if (fflush(s->data) != 0 || fsync(fileno(s->data)) < 0
+	    || fflush(s->ovflow) != 0 || fsync(fileno(s->ovflow)) < 0)
+		fatal("Can't write relation files");
+	writeInfo(s, s->info);
+	if (fflush(s->info) != 0 || fsync(fileno(s->info)) < 0)
+		fatal("Can't sync info file");
+	return swapRelation(r, s);
+}
+
+// get an empty, pinned overflow page, reusing a free one if possible
+
+static Page newOvflowPage(Reln r, PageID *pid)
+{
+	if (r->freeov == NO_PAGE)
+		return pinNewPage(r->pool, r->ovflow, pid);
+	*pid = r->freeov;
+	Page pg = pinPage(r->pool, r->ovflow, *pid);
+	r->freeov = pageOvflow(pg);
+	r->nfree--;
+	initPage(pg, r->pagesize, r->flags);
+	return pg;
+}
+
+// return an overflow page to the free list
+
+static void freeOvflowPage(Reln r, PageID pid)
+{
+	Page pg = pinPage(r->pool, r->ovflow, pid);
+	initPage(pg, r->pagesize, r->flags);
+	pageSetOvflow(pg, r->freeov);
+	unpinPage(r->pool, pg, TRUE);
+	r->freeov = pid;
+	r->nfree++;
+}
+
 // insert a new tuple into a relation
 // returns index of bucket where inserted
 // - index always refers to a primary data page
 // - the actual insertion page may be either a data page or an overflow page
 // returns NO_PAGE if insert fails completely
+// inserts become durable in batches of WALBATCH (see commitRelation)
 PageID addToRelation(Reln r, Tuple t)
 {
-	Bits h, p;
-	// char buf[MAXBITS+5]; //*** for debug
-	// The hashed tuple
-	h = tupleHash(r,t);
+	return addHashedToRelation(r, t, tupleHash(r, t));
+}
 
-	// Get the page
-	if (r->depth == 0)
-		p = 0;
-	else {
-		p = getLower(h, r->depth);
-		if (p < r->sp) p = getLower(h, r->depth+1);
+// as for addToRelation, where h is the tuple's tupleHash()
+// lets the caller do the hashing elsewhere (e.g. on another thread)
+
+PageID addHashedToRelation(Reln r, Tuple t, Bits h)
+{
+	PageID p = insertTuple(r, t, h);
+	if (p != NO_PAGE && r->wal != NULL && ++r->nbatch >= WALBATCH)
+		commitRelation(r);
+	return p;
+}
+
+// delete the tuples matching pattern from buckets[0..nb-1], which
+// must include every bucket that could hold a match
+// (e.g. as found by startSelection); returns #tuples deleted
+
+Count deleteFromRelation(Reln r, PageID *buckets, Count nb, Tuple pattern)
+{
+	Count n = 0;
+	Matcher m = newMatcher(pattern, r->nattrs);
+	for (Count i = 0; i < nb; i++)
+		n += changeBucket(r, buckets[i], m, NULL, NULL, NULL);
+	freeMatcher(m);
+	while (underFull(r)) mergeBucket(r);
+	return n;
+}
+
+// as for deleteFromRelation, but matching tuples are changed by
+// tupleAssign(t, set) instead; returns #tuples updated
+
+Count updateRelation(Reln r, PageID *buckets, Count nb, Tuple pattern,
+                     Tuple set)
+{
+	Count n = 0, nmoved = 0;
+	Tuple *moved = NULL;
+	Matcher m = newMatcher(pattern, r->nattrs);
+	for (Count i = 0; i < nb; i++)
+		n += changeBucket(r, buckets[i], m, set, &moved, &nmoved);
+	freeMatcher(m);
+	// tuples that had to leave their page go back in once every
+	// bucket has been seen, so none is updated twice
+	for (Count i = 0; i < nmoved; i++) {
+		PageID ok = addToRelation(r, moved[i]);
+		assert(ok != NO_PAGE);
+		free(moved[i]);
+	}
+	free(moved);
+	while (underFull(r)) mergeBucket(r);
+	return n;
+}
+
+// delete (set == NULL) or update the tuples in bucket b matched
+// by m; updated tuples that can't stay in their page are added
+// to *moved, for the caller to insert again
+// returns #tuples deleted or updated
+
+static Count changeBucket(Reln r, PageID b, Matcher m, Tuple set,
+                          Tuple **moved, Count *nmoved)
+{
+	BufPool bp = r->pool;
+	if (r->tails == NULL) findTails(r);
+	if (r->nbytes == NO_BYTES) countBytes(r);
+	Count n = 0;
+	char buf[MAXTUPLEN], newt[MAXTUPLEN];
+	FILE *f = r->data;
+	PageID pid = b, last = NO_PAGE;
+	Page prev = NULL;  // previous page in chain, still pinned
+	Bool prevdirty = FALSE;
+	Count nchain = 0, slack = 0;  // #pages kept, and their free space
+	while (pid != NO_PAGE) {
+		Page pg = pinPage(bp, f, pid);
+		Bool dirty = FALSE;
+		for (Count s = 0; s < pageNSlots(pg); s++) {
+			Tuple t = pageTuple(pg, s, buf);
+			if (t == NULL || !matchTuple(m, t)) continue;
+			n++;
+			dirty = TRUE;
+			r->nbytes -= recordSpace(tupLength(t), r->flags);
+			if (set == NULL) {
+				deleteFromPage(pg, s);
+				r->ntups--;
+				continue;
+			}
+			if (tupleAssign(t, set, newt) != OK)
+				fatal("Updated tuple is too long");
+			// the slot is reused, or a lower one, so the scan
+			// never meets the new version
+			deleteFromPage(pg, s);
+			Bits h = tupleHash(r, newt);
+			if (bucketFor(h, r->depth, r->sp) == b
+			    && addToPage(pg, newt, h) == OK) {
+				r->nbytes += recordSpace(tupLength(newt), r->flags);
+				continue;
+			}
+			r->ntups--;
+			// *moved doubles whenever its length reaches a power of 2
+			if ((*nmoved & (*nmoved-1)) == 0) {
+				Count size = (*nmoved == 0) ? 1 : 2 * *nmoved;
+				*moved = realloc(*moved, size*sizeof(Tuple));
+				assert(*moved != NULL);
+			}
+			(*moved)[(*nmoved)++] = copyString(newt);
+		}
+		if (dirty) compactPage(pg);
+		PageID next = pageOvflow(pg);
+		if (f == r->ovflow && pageNTuples(pg) == 0) {
+			// unlink the empty overflow page
+			pageSetOvflow(prev, next);
+			prevdirty = TRUE;
+			unpinPage(bp, pg, dirty);
+			freeOvflowPage(r, pid);
+		}
+		else {
+			if (prev != NULL) unpinPage(bp, prev, prevdirty);
+			prev = pg;
+			prevdirty = dirty;
+			last = (f == r->data) ? NO_PAGE : pid;
+			nchain++;
+			slack += pageFreeSpace(pg);
+		}
+		pid = next;
+		f = r->ovflow;
 	}
+	r->tails[b].last = last;
+	r->tails[b].free = pageFreeSpace(prev);
+	unpinPage(bp, prev, prevdirty);
+	if (n > 0 && nchain > 1 && slack >= pageCapacity(r->pagesize))
+		packBucket(r, b, nchain);
+	return n;
+}
 
-	Page pg = getPage(r->data,p);
-	
-	// Write to the pate
-	if (addToPage(pg,t) == OK) {
-		putPage(r->data,p,pg);
-		r->ntups++;
+// rewrite the nchain pages of bucket b so that its tuples, in
+// order, fill as few pages as they can
+// - each page is copied into the spare page before its tuples are
+//   added again, so the chain's overflow pages can take the packed
+//   tuples (in chain order) as soon as they have been read
+// - overflow pages left over go back on the free list
 
-		// Split
-		if (capacity(r)) splitBucket(r);
+static void packBucket(Reln r, PageID b, Count nchain)
+{
+	BufPool bp = r->pool;
+	if (r->spare == NULL) {
+		r->spare = malloc(r->pagesize);
+		assert(r->spare != NULL);
+	}
+	Page old = r->spare;
+	PageID reuse[nchain];  // overflow pages read so far
+	Count nread = 0, nused = 0;
+	Page dst = pinPage(bp, r->data, b);
+	memcpy(old, dst, r->pagesize);
+	initPage(dst, r->pagesize, r->flags);
+	PageID last = NO_PAGE;
+	char buf[MAXTUPLEN];
+	for (;;) {
+		Bool hashed = pageIsHashed(old);
+		for (Count s = 0; s < pageNSlots(old); s++) {
+			Tuple t = pageTuple(old, s, buf);
+			if (t == NULL) continue;
+			Bits h = hashed ? pageTupleHash(old, s) : 0;
+			if (addToPage(dst, t, h) == OK) continue;
+			PageID ovp;
+			Page ovpg;
+			if (nused < nread) {
+				ovp = reuse[nused++];
+				ovpg = pinPage(bp, r->ovflow, ovp);
+				initPage(ovpg, r->pagesize, r->flags);
+			}
+			else
+				ovpg = newOvflowPage(r, &ovp);
+			pageSetOvflow(dst, ovp);
+			unpinPage(bp, dst, TRUE);
+			dst = ovpg;
+			last = ovp;
+			Status ok = addToPage(dst, t, h);
+			assert(ok == OK);
+		}
+		PageID pid = pageOvflow(old);
+		if (pid == NO_PAGE) break;
+		Page pg = pinPage(bp, r->ovflow, pid);
+		memcpy(old, pg, r->pagesize);
+		unpinPage(bp, pg, FALSE);
+		reuse[nread++] = pid;
+	}
+	while (nused < nread) freeOvflowPage(r, reuse[nused++]);
+	r->tails[b].last = last;
+	r->tails[b].free = pageFreeSpace(dst);
+	unpinPage(bp, dst, TRUE);
+}
 
-		return p;
+// bulk-load tuples from file in into an empty relation
+// (see the comment at the top of this file)
+// a relation that already has tuples gets them one at a time
+// returns the number of tuples loaded
+
+Count loadRelation(Reln r, FILE *in)
+{
+	Tuple t;
+	Count ntups = 0;
+	TupleReader rd = newTupleReader(r, in);
+	if (r->ntups > 0) {
+		while ((t = nextTuple(rd)) != NULL) {
+			PageID ok = addToRelation(r, t);
+			assert(ok != NO_PAGE);
+			ntups++;
+		}
+		freeTupleReader(rd);
+		return ntups;
 	}
 
-	// primary data page full
-	if (pageOvflow(pg) == NO_PAGE) {
-		// add first overflow page in chain
-		PageID newp = addPage(r->ovflow);
-		pageSetOvflow(pg,newp);
-		putPage(r->data,p,pg);
+	// read the input, hashing each tuple once (LOADCHUNK at a
+	// time, see tupleHashes)
+	Loader ld = newLoader(r, 0, 0);
+	Tuple chunk[LOADCHUNK];
+	Bits hs[LOADCHUNK];
+	Count nchunk = 0;
+	do {
+		t = nextTuple(rd);
+		if (t != NULL) {
+			chunk[nchunk++] = copyString(t);
+			if (nchunk < LOADCHUNK) continue;
+		}
+		tupleHashes(r, chunk, nchunk, hs);
+		for (Count k = 0; k < nchunk; k++)
+			addToLoader(ld, chunk[k], hs[k]);
+		nchunk = 0;
+	} while (t != NULL);
+	freeTupleReader(rd);
+	return finishLoader(ld);
+}
 
-		// Close dataPage and get an overflow page and write to the overflow page
+// start a bulk load of empty relation r
+// ntups and nbytes are what will be added (their recordSpace), or
+// 0 if not known; knowing nbytes fixes the shape of the file upfront
 
-		Page newpg = getPage(r->ovflow,newp);
-		if (addToPage(newpg,t) != OK) return NO_PAGE;
-		putPage(r->ovflow,newp,newpg);
-		r->ntups++;
+Loader newLoader(Reln r, Count ntups, uint64_t nbytes)
+{
+	assert(r->ntups == 0);
+	Loader ld = malloc(sizeof(struct LoaderRep));
+	assert(ld != NULL);
+	ld->r = r;
+	ld->ntups = ld->nbytes = 0;
+	ld->mem = 0;
+	ld->size = 1024;
+	ld->items = malloc(ld->size*sizeof(LoadItem));
+	assert(ld->items != NULL);
+	ld->nitems = 0;
+	ld->spill = NULL;
+	ld->np = 0;
+	ld->nruns = 1;
+	ld->runs = NULL;
+	if (nbytes > 0) {
+		loaderShape(ld, nbytes);
+		size_t mem = nbytes + (size_t)ntups*sizeof(LoadItem);
+		if (mem > BULKMEM) openRuns(ld, mem);
+	}
+	return ld;
+}
 
-		// Split
-		if (capacity(r)) splitBucket(r);
+// add tuple t, with tupleHash() h, to a bulk load
+// t must be malloc'd; the loader frees it
 
-		return p;
-	
-	} else {
-		// scan overflow chain until we find space
-		// worst case: add new ovflow page at end of chain
+void addToLoader(Loader ld, Tuple t, Bits h)
+{
+	LoadItem it = { h, 0, ld->ntups++, t };
+	ld->nbytes += recordSpace(tupLength(t), ld->r->flags);
+	ld->mem += strlen(t) + 1 + sizeof(LoadItem);
+	if (ld->runs != NULL) {
+		PageID b = bucketFor(h, ld->d, ld->sp);
+		putLoadItem(ld->runs[(unsigned long long)b*ld->nruns/ld->np], &it);
+		free(t);
+		return;
+	}
+	// past BULKMEM bytes, everything goes to a spill file
+	if (ld->spill == NULL && ld->mem > BULKMEM) {
+		ld->spill = tmpfile();
+		assert(ld->spill != NULL);
+		for (Count i = 0; i < ld->nitems; i++) {
+			putLoadItem(ld->spill, &ld->items[i]);
+			free(ld->items[i].tuple);
+		}
+		ld->nitems = 0;
+	}
+	if (ld->spill != NULL) {
+		putLoadItem(ld->spill, &it);
+		free(t);
+		return;
+	}
+	if (ld->nitems == ld->size) {
+		ld->size *= 2;
+		ld->items = realloc(ld->items, ld->size*sizeof(LoadItem));
+		assert(ld->items != NULL);
+	}
+	ld->items[ld->nitems++] = it;
+}
 
-		// Start from the first overflow page
-		Page ovpg, prevpg = NULL;
-		PageID ovp, prevp = NO_PAGE;
-		ovp = pageOvflow(pg);
-		free(pg);
+// write out everything added to a bulk load, and release the loader
+// returns the number of tuples loaded
 
-		// Traverse the overflow chain
-		while (ovp != NO_PAGE) {
-			ovpg = getPage(r->ovflow, ovp);
+Count finishLoader(Loader ld)
+{
+	Reln r = ld->r;
+	if (ld->np == 0) loaderShape(ld, ld->nbytes);
+	Count np = ld->np, d = ld->d;
+	Offset sp = ld->sp;
 
-			if (addToPage(ovpg,t) != OK) {
-			    if (prevpg != NULL) free(prevpg);
-				prevp = ovp; prevpg = ovpg;
-				ovp = pageOvflow(ovpg);
-			}
-			else {
-				if (prevpg != NULL) free(prevpg);
-				putPage(r->ovflow,ovp,ovpg);
-				r->ntups++;
+	// split the spill file into runs of consecutive buckets,
+	// each small enough to sort in memory
+	if (ld->spill != NULL) {
+		openRuns(ld, ld->mem);
+		rewind(ld->spill);
+		LoadItem it;
+		while (getLoadItem(ld->spill, &it)) {
+			PageID b = bucketFor(it.hash, d, sp);
+			putLoadItem(ld->runs[(unsigned long long)b*ld->nruns/np], &it);
+			free(it.tuple);
+		}
+		fclose(ld->spill);
+	}
+	Count nruns = ld->nruns;
+	LoadItem *items = ld->items;
+	Count nitems = ld->nitems, size = ld->size;
 
-				// Split
-				if (capacity(r)) splitBucket(r);
+	// make the files empty, in the buffer pool and log too
+	// (a shadow's files aren't the relation's yet, so it needs no
+	// marker)
+	if (r->wal != NULL) checkpointRelation(r);
+	clearBufPool(r->pool);
+	char fname[MAXFILENAME];
+	sprintf(fname, "%s.load", r->name);
+	if (!r->shadow) {
+		FILE *marker = fopen(fname, "w");
+		assert(marker != NULL);
+		fclose(marker);
+	}
 
-				return p;
+	// write each bucket's pages in turn
+	r->npages = np;
+	growTails(r);
+	Page pg = malloc(r->pagesize);
+	assert(pg != NULL);
+	PageID nextov = 0;  // next page in ovflow file
+	Count i = 0;        // next item to place
+	for (PageID b = 0; b < np; b++) {
+		Count run = (unsigned long long)b*nruns/np;
+		if (b == 0 || run != (unsigned long long)(b-1)*nruns/np) {
+			// next run of buckets
+			if (ld->runs != NULL) {
+				rewind(ld->runs[run]);
+				nitems = 0;
+				LoadItem it;
+				while (getLoadItem(ld->runs[run], &it)) {
+					if (nitems == size) {
+						size *= 2;
+						items = realloc(items, size*sizeof(LoadItem));
+						assert(items != NULL);
+					}
+					items[nitems++] = it;
+				}
+				fclose(ld->runs[run]);
+			}
+			for (Count j = 0; j < nitems; j++)
+				items[j].bucket = bucketFor(items[j].hash, d, sp);
+			qsort(items, nitems, sizeof(LoadItem), cmpLoadItem);
+			i = 0;
+		}
+		FILE *f = r->data;
+		PageID pid = b;
+		initPage(pg, r->pagesize, r->flags);
+		for (; i < nitems && items[i].bucket == b; i++) {
+			if (addToPage(pg, items[i].tuple, items[i].hash) != OK) {
+				pageSetOvflow(pg, nextov);
+				writePage(f, pid, pg, r->pagesize);
+				f = r->ovflow; pid = nextov++;
+				initPage(pg, r->pagesize, r->flags);
+				Status ok = addToPage(pg, items[i].tuple, items[i].hash);
+				assert(ok == OK);
 			}
+			free(items[i].tuple);
 		}
+		writePage(f, pid, pg, r->pagesize);
+		r->tails[b].last = (f == r->data) ? NO_PAGE : pid;
+		r->tails[b].free = pageFreeSpace(pg);
+	}
+	free(pg);
+	free(items);
+	free(ld->runs);
+
+	// the new pages are durable before .info describes them
+	if (fflush(r->data) != 0 || fsync(fileno(r->data)) < 0
+	    || fflush(r->ovflow) != 0
+	    || ftruncate(fileno(r->ovflow), (off_t)nextov*r->pagesize) < 0
+	    || fsync(fileno(r->ovflow)) < 0)
+		fatal("Can't write relation files");
+	r->depth = d; r->sp = sp;
+	r->ntups = ld->ntups; r->nbytes = ld->nbytes;
+	r->freeov = NO_PAGE; r->nfree = 0;
+	writeInfo(r, r->info);
+	if (fflush(r->info) != 0 || fsync(fileno(r->info)) < 0)
+		fatal("Can't sync info file");
+	if (!r->shadow) remove(fname);
+	Count ntups = ld->ntups;
+	free(ld);
+	return ntups;
+}
+
+// the shape of the file after one-at-a-time inserts of tuples
+// taking nbytes
+
+static void loaderShape(Loader ld, uint64_t nbytes)
+{
+	Count np = pagesFor(ld->r, nbytes);
+	if (np < ld->r->npages) np = ld->r->npages;
+	Count d = 0;
+	while ((2u << d) <= np) d++;
+	ld->np = np;
+	ld->d = d;
+	ld->sp = np - (1u << d);
+}
 
-		// all overflow pages are full; add another to chain
-		// at this point, there *must* be a prevpg
-		assert(prevpg != NULL);
-		// make new ovflow page
-		PageID newp = addPage(r->ovflow);
-		// insert tuple into new page
-		Page newpg = getPage(r->ovflow,newp);
+// start partitioning a load that needs mem bytes into runs of
+// consecutive buckets, each small enough to sort in memory
 
-        if (addToPage(newpg,t) != OK) return NO_PAGE;
-        putPage(r->ovflow,newp,newpg);
-		// link to existing overflow chain
-		pageSetOvflow(prevpg,newp);
-		putPage(r->ovflow,prevp,prevpg);
-        r->ntups++;
+static void openRuns(Loader ld, size_t mem)
+{
+	ld->nruns = 1 + mem/(BULKMEM/2);
+	ld->runs = malloc(ld->nruns*sizeof(FILE *));
+	assert(ld->runs != NULL);
+	for (Count k = 0; k < ld->nruns; k++) {
+		ld->runs[k] = tmpfile();
+		assert(ld->runs[k] != NULL);
+	}
+}
 
-		// Split
-		if (capacity(r)) splitBucket(r);
+// an empty relation like r (open for writing) but with choice vector
+// cv (NULL keeps r's), to load r's tuples into (see the comment at
+// the top of this file)
+// returns NULL if cv is not valid
 
-		return p;
+Reln shadowRelation(Reln r, char *cv)
+{
+	assert(r->mode == 'w' && !r->legacy);
+	Reln s = malloc(sizeof(struct RelnRep));
+	assert(s != NULL);
+	*s = *r;
+	if (cv != NULL && parseChVec(s, cv, s->cv) != OK) {
+		free(s);
+		return NULL;
 	}
+	compileHashPlan(s->cv, hashFunction(s->hashid), &s->plan);
+	s->name = copyString(r->name);
+	s->gen = r->gen + 1;
+	s->shadow = TRUE;
+	s->ntups = 0; s->nbytes = 0;
+	s->freeov = NO_PAGE; s->nfree = 0;
+	s->tails = NULL; s->maxtails = 0;
+	s->spare = NULL;
+	s->wal = NULL; s->nbatch = 0;
+	s->split = 0;
+	char fname[MAXFILENAME];
+	sprintf(fname, "%s.info.tmp", r->name);
+	s->info = fopen(fname, "w");
+	assert(s->info != NULL);
+	pageFile(fname, r->name, "data", s->gen);
+	s->data = fopen(fname, "w");
+	assert(s->data != NULL);
+	pageFile(fname, r->name, "ovflow", s->gen);
+	s->ovflow = fopen(fname, "w");
+	assert(s->ovflow != NULL);
+	s->pool = newBufPool(BUFBYTES/s->pagesize, s->pagesize, s->flags);
+	return s;
+}
 
-	return NO_PAGE;
+// make s, a loaded shadowRelation of r, the relation r's name refers
+// to, and close both; if the swap fails, r is left as it was
+
+Status swapRelation(Reln r, Reln s)
+{
+	assert(s->shadow && s->gen == r->gen + 1);
+	char fname[MAXFILENAME], tname[MAXFILENAME];
+	// finishLoader has synced s's files; nothing more to write
+	s->mode = 'r';
+	closeRelation(s);
+	// r's log is left as it is: the new generation has its own, and
+	// readers of r may still be reading this one
+	sprintf(tname, "%s.info.tmp", r->name);
+	sprintf(fname, "%s.info", r->name);
+	Status ok = (rename(tname, fname) == 0) ? OK : ~OK;
+	// the new .info must be durable before the files the old one
+	// names can go
+	if (ok == OK) syncDir(r->name);
+	// r's files go once nothing new can open them; readers that
+	// already have them keep them until they close, and a writer
+	// that opened them finds .info replaced once it has the lock
+	Count gen = (ok == OK) ? r->gen : r->gen + 1;
+	char *name = copyString(r->name);
+	r->mode = 'r';
+	closeRelation(r);
+	pageFile(fname, name, "data", gen);
+	remove(fname);
+	pageFile(fname, name, "ovflow", gen);
+	remove(fname);
+	pageFile(fname, name, "wal", gen);
+	remove(fname);
+	if (ok != OK) remove(tname);
+	free(name);
+	return ok;
+}
+
+static PageID insertTuple(Reln r, Tuple t, Bits h)
+{
+	Bits p;
+	// char buf[MAXBITS+5]; //*** for debug
+
+	// Get the page
+	p = bucketFor(h, r->depth, r->sp);
+
+	// Add to the end of the bucket
+	if (r->tails == NULL) findTails(r);
+	if (r->nbytes == NO_BYTES) countBytes(r);
+	if (addToBucket(r, p, t, h) != OK) return NO_PAGE;
+	r->ntups++;
+	r->nbytes += recordSpace(tupLength(t), r->flags);
+
+	// Split
+	while (overFull(r)) splitBucket(r);
+
+	return p;
+}
+
+// add a tuple to the last page of bucket b
+// if that page is full, a new overflow page is added to the chain
+// earlier pages in the chain are never visited
+
+static Status addToBucket(Reln r, PageID b, Tuple t, Bits h)
+{
+	BufPool bp = r->pool;
+	Tail *tl = &r->tails[b];
+	Page pg;
+	if (tl->last == NO_PAGE)
+		pg = pinPage(bp, r->data, b);
+	else
+		pg = pinPage(bp, r->ovflow, tl->last);
+	// too little room (even if compressed) means no need to try
+	Count least = (pageIsCompressed(pg) ? r->nattrs : tupLength(t)+1) + 4;
+	if (tl->free >= least && addToPage(pg, t, h) == OK) {
+		tl->free = pageFreeSpace(pg);
+		unpinPage(bp, pg, TRUE);
+		return OK;
+	}
+	// start a new last page
+	PageID newp;
+	Page newpg = newOvflowPage(r, &newp);
+	Status ok = addToPage(newpg, t, h);
+	pageSetOvflow(pg, newp);
+	unpinPage(bp, pg, TRUE);
+	tl->last = newp;
+	tl->free = pageFreeSpace(newpg);
+	unpinPage(bp, newpg, TRUE);
+	return ok;
+}
+
+// make room in tails[] for every bucket
+
+static void growTails(Reln r)
+{
+	if (r->maxtails >= r->npages) return;
+	Count n = (r->maxtails == 0) ? 64 : r->maxtails;
+	while (n < r->npages) n *= 2;
+	r->tails = realloc(r->tails, n*sizeof(Tail));
+	assert(r->tails != NULL);
+	r->maxtails = n;
+}
+
+// find the last page of every bucket by walking its chain
+
+static void findTails(Reln r)
+{
+	growTails(r);
+	for (PageID b = 0; b < r->npages; b++) {
+		Tail *tl = &r->tails[b];
+		Page pg = pinPage(r->pool, r->data, b);
+		tl->last = NO_PAGE;
+		PageID ovp = pageOvflow(pg);
+		while (ovp != NO_PAGE) {
+			unpinPage(r->pool, pg, FALSE);
+			pg = pinPage(r->pool, r->ovflow, ovp);
+			tl->last = ovp;
+			ovp = pageOvflow(pg);
+		}
+		tl->free = pageFreeSpace(pg);
+		unpinPage(r->pool, pg, FALSE);
+	}
 }
 
 // external interfaces for Reln data
@@ -229,10 +1313,18 @@ FILE *dataFile(Reln r) { return r->data; }
 FILE *ovflowFile(Reln r) { return r->ovflow; }
 Count nattrs(Reln r) { return r->nattrs; }
 Count npages(Reln r) { return r->npages; }
+Count pagesize(Reln r) { return r->pagesize; }
+Count pageFlags(Reln r) { return r->flags; }
+Count fillFactor(Reln r) { return r->fill; }
 Count ntuples(Reln r) { return r->ntups; }
+// space the tuples need uncompressed (0 if not known)
+uint64_t nbytes(Reln r) { return (r->nbytes == NO_BYTES) ? 0 : r->nbytes; }
 Count depth(Reln r)  { return r->depth; }
 Count splitp(Reln r) { return r->sp; }
 ChVecItem *chvec(Reln r)  { return r->cv; }
+HashPlan *hashPlan(Reln r) { return &r->plan; }
+Bool isLegacyRelation(Reln r) { return r->legacy; }
+BufPool bufPool(Reln r) { return r->pool; }
 
 
 // displays info about open Reln
@@ -240,8 +1332,17 @@ ChVecItem *chvec(Reln r)  { return r->cv; }
 void relationStats(Reln r)
 {
 	printf("Global Info:\n");
-	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%d\n",
-	       r->nattrs, r->npages, r->ntups, r->depth, r->sp);
+	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%d  pagesize:%d\n",
+	       r->nattrs, r->npages, r->ntups, r->depth, r->sp, r->pagesize);
+	printf("#free ovflow pages:%d  (first:%d)  compressed:%s  hashed:%s\n",
+	       r->nfree, r->freeov, (r->flags & PAGE_COMPRESSED) ? "yes" : "no",
+	       (r->flags & PAGE_HASHED) ? "yes" : "no");
+	if (r->nbytes == NO_BYTES)
+		printf("target fill:%d%%  load:unknown", r->fill);
+	else
+		printf("target fill:%d%%  load:%.1f%%", r->fill, 100.0 * r->nbytes
+		       / ((double)r->npages * pageCapacity(r->pagesize)));
+	printf("  hash:%s\n", hashName(r->hashid));
 	printf("Choice vector\n");
 	printChVec(r->cv);
 	printf("Bucket Info:\n");
@@ -250,135 +1351,239 @@ void relationStats(Reln r)
 	for (Offset pid = 0; pid < r->npages; pid++) {
 		printf("[%2d]  ",pid);
 
-		Page p = getPage(r->data, pid);
+		Page p = pinPage(r->pool, r->data, pid);
 
 		Count ntups = pageNTuples(p);
 		Count space = pageFreeSpace(p);
 		Offset ovid = pageOvflow(p);
 		printf("(d%d,%d,%d,%d)",pid,ntups,space,ovid);
-		free(p);
+		unpinPage(r->pool, p, FALSE);
 		while (ovid != NO_PAGE) {
 			Offset curid = ovid;
-			p = getPage(r->ovflow, ovid);
+			p = pinPage(r->pool, r->ovflow, ovid);
 
 			ntups = pageNTuples(p);
 			space = pageFreeSpace(p);
 			ovid = pageOvflow(p);
 			printf(" -> (ov%d,%d,%d,%d)",curid,ntups,space,ovid);
-			free(p);
+			unpinPage(r->pool, p, FALSE);
 		}
 		putchar('\n');
 	}
 }
 
-int capacity(Reln r) {
-	int c = 1024 / (10 * r->nattrs);
-	return r->ntups % c == 0;
+// is the load factor above the target?
+static Bool overFull(Reln r) {
+	return r->npages < pagesFor(r, r->nbytes);
+}
+
+// is the load factor below half the target, in a file larger than
+// it was created?
+static Bool underFull(Reln r) {
+	return r->npages > r->minpages && 2*pagesFor(r, r->nbytes) < r->npages;
+}
+
+// the least #pages that holds nbytes at the target load factor
+static Count pagesFor(Reln r, uint64_t nbytes) {
+	uint64_t cap = (uint64_t)pageCapacity(r->pagesize) * r->fill;
+	return (nbytes * 100 + cap - 1) / cap;
+}
+
+// work out nbytes for a relation that didn't keep it
+
+static void countBytes(Reln r)
+{
+	char buf[MAXTUPLEN];
+	r->nbytes = 0;
+	for (PageID b = 0; b < r->npages; b++) {
+		FILE *f = r->data;
+		PageID pid = b;
+		while (pid != NO_PAGE) {
+			Page pg = pinPage(r->pool, f, pid);
+			Count pos = 0;
+			Tuple t;
+			while ((t = pageNextTuple(pg, &pos, buf)) != NULL)
+				r->nbytes += recordSpace(tupLength(t), r->flags);
+			pid = pageOvflow(pg);
+			unpinPage(r->pool, pg, FALSE);
+			f = r->ovflow;
+		}
+	}
+}
+
+// undo the last split: move the tuples of the last bucket onto the
+// end of its buddy's chain and drop its page
+// like splitBucket, each old page is read once into the spare page,
+// and its overflow pages are freed as soon as they have been read
+
+static void mergeBucket(Reln r)
+{
+	BufPool bp = r->pool;
+	if (r->npages <= 1) return;
+	if (r->tails == NULL) findTails(r);
+	if (r->spare == NULL) {
+		r->spare = malloc(r->pagesize);
+		assert(r->spare != NULL);
+	}
+	if (r->sp == 0) {
+		r->depth--;
+		r->sp = 1 << r->depth;
+	}
+	r->sp--;
+	PageID keep = r->sp, gone = r->npages - 1;
+	assert(gone == (1u << r->depth) + r->sp);
+
+	Tail *tl = &r->tails[keep];
+	Page dst = (tl->last == NO_PAGE) ? pinPage(bp, r->data, keep)
+	                                 : pinPage(bp, r->ovflow, tl->last);
+	Page old = r->spare;
+	Page pg = pinPage(bp, r->data, gone);
+	memcpy(old, pg, r->pagesize);
+	unpinPage(bp, pg, FALSE);
+	char buf[MAXTUPLEN];
+	for (;;) {
+		Bool hashed = pageIsHashed(old);
+		for (Count s = 0; s < pageNSlots(old); s++) {
+			Tuple t = pageTuple(old, s, buf);
+			if (t == NULL) continue;
+			Bits h = hashed ? pageTupleHash(old, s) : 0;
+			if (addToPage(dst, t, h) == OK) continue;
+			PageID ovp;
+			Page ovpg = newOvflowPage(r, &ovp);
+			pageSetOvflow(dst, ovp);
+			unpinPage(bp, dst, TRUE);
+			dst = ovpg;
+			tl->last = ovp;
+			Status ok = addToPage(dst, t, h);
+			assert(ok == OK);
+		}
+		PageID pid = pageOvflow(old);
+		if (pid == NO_PAGE) break;
+		pg = pinPage(bp, r->ovflow, pid);
+		memcpy(old, pg, r->pagesize);
+		unpinPage(bp, pg, FALSE);
+		freeOvflowPage(r, pid);
+	}
+	tl->free = pageFreeSpace(dst);
+	unpinPage(bp, dst, TRUE);
+	r->npages--;
+}
+
+// the bucket for hash value h in a file of given depth and split pointer
+static PageID bucketFor(Bits h, Count depth, Offset sp) {
+	if (depth == 0) return 0;
+	PageID p = getLower(h, depth);
+	if (p < sp) p = getLower(h, depth+1);
+	return p;
+}
+
+// the bucket for hash value h in r as it is now
+PageID bucketOf(Reln r, Bits h) { return bucketFor(h, r->depth, r->sp); }
+
+// the name of a relation's data, ovflow or wal file (kind) in
+// generation gen: Rel.data, Rel.ovflow and Rel.wal at first, then
+// Rel.data.1, Rel.ovflow.1 and Rel.wal.1 after a reorganisation,
+// and so on
+
+static void pageFile(char *buf, char *name, char *kind, Count gen)
+{
+	if (gen == 0)
+		sprintf(buf, "%s.%s", name, kind);
+	else
+		sprintf(buf, "%s.%s.%d", name, kind, gen);
 }
 
+// split bucket sp into buckets sp and 2^depth+sp
+// - the old chain is read once, a page at a time, into the spare page
+//   (so the pages it came from can be reused straight away)
+// - each tuple goes onto the last page of its new bucket; those two
+//   pages stay pinned and are released when full, so every page of
+//   the new chains is filled once, in order
+// - old overflow pages go back on the free list as soon as they have
+//   been read, and new chains take them from there
+
 void splitBucket(Reln r) {
 	int depth = r->depth;
 	int sp = r->sp;
 	int newPageID = (1 << depth) + sp;
-	
-	// Add a new page to the data file
-	assert(addPage(r->data) == newPageID);
+	BufPool bp = r->pool;
+	if (r->tails == NULL) findTails(r);
+	if (r->spare == NULL) {
+		r->spare = malloc(r->pagesize);
+		assert(r->spare != NULL);
+	}
+	Page old = r->spare;
+
+	// Take a copy of the old primary page, then empty it
+	// dst[0] builds bucket sp, dst[1] the new bucket
+	Page dst[2];
+	PageID last[2] = { NO_PAGE, NO_PAGE };
+	dst[0] = pinPage(bp, dataFile(r), sp);
+	memcpy(old, dst[0], r->pagesize);
+	initPage(dst[0], r->pagesize, r->flags);
+
+	// Add a new page to the data file (or reuse one that a merge
+	// dropped)
+	PageID newp = newPageID;
+	if (fseek(r->data, 0, SEEK_END) == 0
+	    && ftell(r->data) > (long)newp*r->pagesize) {
+		dst[1] = pinPage(bp, dataFile(r), newp);
+		initPage(dst[1], r->pagesize, r->flags);
+	}
+	else
+		dst[1] = pinNewPage(bp, dataFile(r), &newp);
+	assert(newp == newPageID);
 	r->npages++;
 
-	// Get all tuple from sp and its overflow pages
-	Page old = getPage(dataFile(r), sp);
-	char *tuple = pageData(old);
-	int nTuples = pageNTuples(old);
-	
-	// Store all tuples
-	Tuple allTuples[nTuples * 10];
-	int total = 0;
-	
-	int count = 0;
-	Offset curtupOffset = 0;
-	while (count < nTuples) {
-		Tuple t = (Tuple) (tuple + curtupOffset);
-		int len = tupLength(t);
-
-        char *buf = malloc(MAXTUPLEN * sizeof(char *));
-        tupleString(t, buf);
-
-		curtupOffset += len + 1;
-        count++;
-
-		allTuples[total] = buf;
-		total++;
-
-		// The main page done
-		if (count == nTuples) {
-			// Go to the overflow page
-			Offset ovFlow = pageOvflow(old);
-			if (ovFlow != NO_PAGE) {
-				free(old);
-				old = getPage(ovflowFile(r), ovFlow);
-
-				tuple = pageData(old);
-				nTuples = pageNTuples(old);
-				count = 0;
-				curtupOffset = 0;
-			}
+	// Move each tuple of sp and its overflow pages to its new bucket
+	// (bit depth of its hash says which; hashed pages store the hash)
+	// (tuples read in place are hashed a page at a time)
+	char buf[MAXTUPLEN];
+	for (;;) {
+		Bool hashed = pageIsHashed(old);
+		Bool batch = !hashed && !pageIsCompressed(old);
+		Count ns = pageNSlots(old), k = 0;
+		Bits hs[ns];
+		if (batch) {
+			Tuple ts[ns];
+			Count nt = 0;
+			for (Count s = 0; s < ns; s++)
+				if ((ts[nt] = pageTuple(old, s, buf)) != NULL) nt++;
+			tupleHashes(r, ts, nt, hs);
 		}
+		for (Count s = 0; s < ns; s++) {
+			Tuple t = pageTuple(old, s, buf);
+			if (t == NULL) continue;
+			Bits h = hashed ? pageTupleHash(old, s)
+			       : batch ? hs[k++] : tupleHash(r, t);
+			int i = bitIsSet(h, depth) ? 1 : 0;
+			if (addToPage(dst[i], t, h) == OK) continue;
+			// start the next page in this bucket's chain
+			PageID ovp;
+			Page ovpg = newOvflowPage(r, &ovp);
+			pageSetOvflow(dst[i], ovp);
+			unpinPage(bp, dst[i], TRUE);
+			dst[i] = ovpg;
+			last[i] = ovp;
+			Status ok = addToPage(dst[i], t, h);
+			assert(ok == OK);
+		}
+		// Go to the overflow page
+		PageID pid = pageOvflow(old);
+		if (pid == NO_PAGE) break;
+		Page ovpg = pinPage(bp, ovflowFile(r), pid);
+		memcpy(old, ovpg, r->pagesize);
+		unpinPage(bp, ovpg, FALSE);
+		freeOvflowPage(r, pid);
 	}
 
-	// Clear out the old page.
-	Page empty = newPage();
-	putPage(dataFile(r), sp, empty);
-
-	// Relocate all the tuples;
-
-	for (int i = 0; i < total; i++) {
-		// Get the new Hash
-		Tuple t = allTuples[i];
-        Bits h = tupleHash(r, t);
-        int bucket = getLower(h, depth + 1);
-		
-		// Add
-		Page target = getPage(dataFile(r), bucket);
-
-		if (addToPage(target, t) == OK) {
-			putPage(dataFile(r), bucket, target);
-		} else {
-			// Overflow
-			PageID cur = pageOvflow(target);
-			PageID prev = bucket;
-			Page prevPage = target;
-			while (cur != NO_PAGE) {
-				// If the cur overflow page has place add to it
-				Page ovpg = getPage(ovflowFile(r), cur);
-
-				if (addToPage(ovpg, t) == OK) {
-					putPage(ovflowFile(r), cur, ovpg);
-					free(prevPage);
-					break;
-				}
-				free(prevPage);
-				prev = cur;
-				prevPage = ovpg;
-				cur = pageOvflow(ovpg);
-			}
-			// Add a new overflow page
-			if (cur == NO_PAGE) {
-				PageID newov = addPage(ovflowFile(r));
-				Page newpg = getPage(ovflowFile(r), newov);
-
-				assert(addToPage(newpg, t) == OK);
-				putPage(ovflowFile(r), newov, newpg);
-				// Link the overflow to the previous page
-				pageSetOvflow(prevPage, newov);
-				
-				if (prev < r->npages) {
-					putPage(dataFile(r), prev, prevPage);
-				} else {
-					putPage(ovflowFile(r), prev, prevPage);
-				}
-			}
-		}
-		free(t);
+	// both buckets end where they were filled up to
+	growTails(r);
+	PageID b[2] = { sp, newp };
+	for (int i = 0; i < 2; i++) {
+		r->tails[b[i]].last = last[i];
+		r->tails[b[i]].free = pageFreeSpace(dst[i]);
+		unpinPage(bp, dst[i], TRUE);
 	}
 
 	// Update the sp pointer and the depth
@@ -387,4 +1592,43 @@ void splitBucket(Reln r) {
 		r->sp = 0;
 		r->depth++;
 	}
-}
\ No newline at end of file
+}
+
+// write a load item (less its bucket) to a spill file or run
+
+static void putLoadItem(FILE *f, LoadItem *it)
+{
+	Count len = strlen(it->tuple);
+	if (fwrite(&it->hash, sizeof(Bits), 1, f) != 1
+	    || fwrite(&it->seq, sizeof(Count), 1, f) != 1
+	    || fwrite(&len, sizeof(Count), 1, f) != 1
+	    || fwrite(it->tuple, 1, len, f) != len)
+		fatal("Can't write bulk load spill file");
+}
+
+// read the next load item from a spill file or run
+// returns FALSE at end of file
+
+static Bool getLoadItem(FILE *f, LoadItem *it)
+{
+	Count len;
+	if (fread(&it->hash, sizeof(Bits), 1, f) != 1) return FALSE;
+	if (fread(&it->seq, sizeof(Count), 1, f) != 1
+	    || fread(&len, sizeof(Count), 1, f) != 1 || len >= MAXTUPLEN)
+		fatal("Bulk load spill file is corrupt");
+	it->tuple = malloc(len+1);
+	assert(it->tuple != NULL);
+	if (fread(it->tuple, 1, len, f) != len)
+		fatal("Bulk load spill file is corrupt");
+	it->tuple[len] = '\0';
+	return TRUE;
+}
+
+// order load items by bucket, then input position
+
+static int cmpLoadItem(const void *a, const void *b)
+{
+	const LoadItem *x = a, *y = b;
+	if (x->bucket != y->bucket) return (x->bucket > y->bucket) - (x->bucket < y->bucket);
+	return (x->seq > y->seq) - (x->seq < y->seq);
+}
@@ -5,24 +5,51 @@
 #define RELN_H 1
 
 typedef struct RelnRep *Reln;
+typedef struct LoaderRep *Loader;
 
+#include <stdint.h>
 #include "defs.h"
+#include "bits.h"
 #include "tuple.h"
 #include "page.h"
+#include "buffer.h"
 #include "chvec.h"
 
-Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv);
+Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv,
+                   Count pagesize, Count flags, Count fill, Count hashid);
 Reln openRelation(char *name, char *mode);
 void closeRelation(Reln r);
 Bool existsRelation(char *name);
+Status upgradeRelation(char *name);
+Status vacuumRelation(char *name);
 PageID addToRelation(Reln r, Tuple t);
+PageID addHashedToRelation(Reln r, Tuple t, Bits h);
+PageID bucketOf(Reln r, Bits h);
+void commitRelation(Reln r);
+Count loadRelation(Reln r, FILE *in);
+Loader newLoader(Reln r, Count ntups, uint64_t nbytes);
+void addToLoader(Loader ld, Tuple t, Bits h);
+Count finishLoader(Loader ld);
+Reln shadowRelation(Reln r, char *cv);
+Status swapRelation(Reln r, Reln s);
+Count deleteFromRelation(Reln r, PageID *buckets, Count nb, Tuple pattern);
+Count updateRelation(Reln r, PageID *buckets, Count nb, Tuple pattern,
+                     Tuple set);
 FILE *dataFile(Reln r);
 FILE *ovflowFile(Reln r);
 Count nattrs(Reln r);
 Count npages(Reln r);
+Count ntuples(Reln r);
+uint64_t nbytes(Reln r);
+Count pagesize(Reln r);
+Count pageFlags(Reln r);
+Count fillFactor(Reln r);
 Count depth(Reln r);
 Count splitp(Reln r);
 ChVecItem *chvec(Reln r);
+HashPlan *hashPlan(Reln r);
+BufPool bufPool(Reln r);
+Bool isLegacyRelation(Reln r);
 void relationStats(Reln r);
 
 #endif
@@ -0,0 +1,178 @@
+// reorg.c ... rebuild a relation under a new choice vector
+// Usage:  ./reorg  [-v]  [-j N]  RelName  ChoiceVector
+// The relation is scanned bucket by bucket, N threads (default 2)
+// hash its tuples under the new choice vector, and they are
+// bulk-loaded into new files, which then replace the relation's
+// (see shadowRelation and swapRelation in reln.c)
+// Queries can read the relation throughout; inserts, deletes and
+// updates wait until the new files are in place, and then use them
+// -v shows how many tuples were moved
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include "defs.h"
+#include "reln.h"
+#include "tuple.h"
+#include "select.h"
+#include "queue.h"
+
+#define USAGE "./reorg  [-v]  [-j N]  RelName  ChoiceVector"
+
+// The pipeline is the one insert -j uses, with a scan of the
+// relation in place of the parser
+// - batch k goes from the scanner to hasher k%N, and the main thread
+//   takes batch k from hasher k%N, so the loader gets tuples in
+//   scan order
+// - hashers also copy each tuple for the loader (which frees it), so
+//   the main thread only has to partition them
+
+#define MAXHASHERS 64
+#define BATCHTUPS  256  // tuples per batch
+#define QUEUELEN   8    // batches in flight between two threads
+
+typedef struct {
+	Count n;
+	Tuple tups[BATCHTUPS];  // point into text, then malloc'd copies
+	Bits  hash[BATCHTUPS];
+	char  text[BATCHTUPS*MAXTUPLEN];
+} Batch;
+
+typedef struct {
+	Reln  r;      // relation being scanned
+	Reln  s;      // its replacement, for the new hashes
+	Count n;      // number of hashers
+	Queue *in;    // scanner -> hasher i
+	Queue *out;   // hasher i -> main
+	Count id;     // which hasher this is
+} Stage;
+
+static void *scanStage(void *arg);
+static void *hashStage(void *arg);
+
+// Main ... process args, rebuild relation
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG+MAXRELNAME];  // buffer for error messages
+	int verbose = 0;  // show how many tuples were moved
+	int nhash = 2;  // hashing threads
+	int offset = 0; // adapt offset for options
+
+	// process command-line args
+
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[offset+1], "-j") == 0) {
+			if (offset+2 >= argc) fatal(USAGE);
+			nhash = atoi(argv[offset+2]);
+			if (nhash < 1 || nhash > MAXHASHERS) fatal(USAGE);
+			offset += 1;
+		}
+		else
+			fatal(USAGE);
+		offset += 1;
+	}
+	if (argc != offset+3) fatal(USAGE);
+	char *rname = argv[offset+1];
+	char *cv = argv[offset+2];
+
+	if (!existsRelation(rname)) {
+		sprintf(err, "No such relation: %s", rname);
+		fatal(err);
+	}
+	// holding it open for writing keeps other writers out
+	Reln r = openRelation(rname, "r+");
+	Reln s = shadowRelation(r, cv);
+	if (s == NULL) fatal("Invalid choice vector");
+	Loader ld = newLoader(s, ntuples(r), nbytes(r));
+
+	// start the pipeline and load tuples as they arrive
+	Queue in[MAXHASHERS], out[MAXHASHERS];
+	Stage stages[MAXHASHERS+1];
+	pthread_t threads[MAXHASHERS+1];
+	for (int i = 0; i < nhash; i++) {
+		in[i] = newQueue(QUEUELEN);
+		out[i] = newQueue(QUEUELEN);
+	}
+	for (int i = 0; i <= nhash; i++) {
+		Stage st = { r, s, nhash, in, out, i };
+		stages[i] = st;
+		void *(*fn)(void *) = (i < nhash) ? hashStage : scanStage;
+		if (pthread_create(&threads[i], NULL, fn, &stages[i]) != 0)
+			fatal("Can't start reorg threads");
+	}
+	Batch *b;
+	for (Count k = 0; (b = getQueue(out[k % nhash])) != NULL; k++) {
+		for (Count i = 0; i < b->n; i++)
+			addToLoader(ld, b->tups[i], b->hash[i]);
+		free(b);
+	}
+	for (int i = 0; i <= nhash; i++)
+		pthread_join(threads[i], NULL);
+	for (int i = 0; i < nhash; i++) {
+		freeQueue(in[i]);
+		freeQueue(out[i]);
+	}
+
+	Count n = finishLoader(ld);
+	if (swapRelation(r, s) != OK) {
+		sprintf(err, "Problems while reorganising relation %s", rname);
+		fatal(err);
+	}
+	if (verbose) printf("Reorganised %d tuples\n", n);
+	return 0;
+}
+
+// scan the relation into batches of tuples and deal them out to
+// the hashers
+
+static void *scanStage(void *arg)
+{
+	Stage *st = arg;
+	Count na = nattrs(st->r);
+	char all[2*na];
+	for (Count a = 0; a < na; a++) {
+		all[2*a] = '?';
+		all[2*a+1] = (a < na-1) ? ',' : '\0';
+	}
+	Selection sel = startSelection(st->r, all);
+	Count k = 0;
+	Tuple t = NULL;
+	do {
+		Batch *b = malloc(sizeof(Batch));
+		assert(b != NULL);
+		b->n = 0;
+		char *c = b->text;
+		while (b->n < BATCHTUPS && (t = getNextTuple(sel)) != NULL) {
+			// the selection's copy is gone after the next call
+			b->tups[b->n++] = strcpy(c, t);
+			c += strlen(c)+1;
+		}
+		if (b->n > 0)
+			putQueue(st->in[k++ % st->n], b);
+		else
+			free(b);
+	} while (t != NULL);
+	for (Count i = 0; i < st->n; i++)
+		putQueue(st->in[(k+i) % st->n], NULL);
+	closeSelection(sel);
+	return NULL;
+}
+
+// hash every tuple in each batch under the new choice vector,
+// copy it for the loader, and pass the batch on
+
+static void *hashStage(void *arg)
+{
+	Stage *st = arg;
+	Batch *b;
+	while ((b = getQueue(st->in[st->id])) != NULL) {
+		tupleHashes(st->s, b->tups, b->n, b->hash);
+		for (Count i = 0; i < b->n; i++)
+			b->tups[i] = copyString(b->tups[i]);
+		putQueue(st->out[st->id], b);
+	}
+	putQueue(st->out[st->id], NULL);
+	return NULL;
+}
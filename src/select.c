@@ -8,6 +8,12 @@
 #include "bits.h"
 #include "hash.h"
 #include "util.h"
+#include "match.h"
+#include "buffer.h"
+
+// frames in the buffer pool of a forked selection, which only
+// needs one page at a time
+#define FORKFRAMES 16
 
 struct SelectionRep {
     // Info about rel
@@ -16,26 +22,40 @@ struct SelectionRep {
 	Bits    unknown;        // the unknown bits from MAH
     // Info about page
 	Page    curpage;        // current page in scan
-                            // Need to be freed
+                            // Pinned in the buffer pool
     PageID  curpageID;      // current page id
 	int     is_ovflow;      // are we in the overflow pages?
     // For get nextTuple
-	Offset  curtupOffset;   // offset of current tuple within page
-    Bits    *buckets;       // All the pages we need to go through.
+	Count   curtup;         // scan cursor within page (see pageNextTuple)
+    PageID  *buckets;       // All the pages we need to go through.
                             // Need to be freed
     int     bucketIndex;    // the current bucket index [0..nBuckets-1]
     int     nBuckets;       // The size of the pages
-    int     count;          // The tuples being read       
+    int     lastBucket;     // the scan ends after this bucket (see selectBucket)
+    BufPool pool;           // pages are pinned here: the relation's pool,
+                            // or a fork for a scan in another thread
+    // Prefetching
+    int     prefetch;       // How many buckets to read ahead
+    int     prefetched;     // buckets[0..prefetched-1] have been prefetched
     // Pattern
     Tuple   pattern;        // The pattern to match
                             // Need to be freed
+    Matcher match;          // pattern compiled for matchTuple
+    int     filtered;       // curpage has been marked (see markPage)
+    char    **exact;        // exact-match value for each attr (NULL = none)
+    char    *exactbuf;      // holds the strings in exact[]
+    int     nexact;         // # non-NULL entries in exact[]
+    int     *codes;         // dictionary codes of exact[] in curpage
+    char    tupbuf[MAXTUPLEN]; // tuples from compressed pages decode here
 };
 
 // Helpers
 int hasValue(char *str);
-Bits *computePage(Bits known, Bits unknown, int nStars, Bits lowerBits, int *nBuckets, Reln r);
-Bits getMaskNumber(Bits page, Reln r);
+int cmpPageID(const void *a, const void *b);
 void getNextPage(Selection q);
+void prefetchAhead(Selection q);
+void encodeExact(Selection q);
+int markPage(Selection q);
 
 Selection startSelection(Reln r, char *q)
 {
@@ -47,41 +67,13 @@ Selection startSelection(Reln r, char *q)
 
     char **values = splitTuple(q, nattrs(r));
 
-    Bits knownMask = 0;
-    Bits unknownMask = 0;
-
-    ChVecItem *cvs = chvec(r);
-    int nStars = 0;
-    for (int i = 0; i < 32; i++) {
-        int attrNum = cvs[i].att;
-        int bitPos = cvs[i].bit;
-
-        if (hasValue(values[attrNum])) {
-            Bits hash = hash_any((unsigned char *)values[attrNum],strlen(values[attrNum])); 
-            if (bitIsSet(hash, bitPos)) {
-                knownMask = setBit(knownMask, i);
-            } else {
-                knownMask = unsetBit(knownMask, i);
-            }
-        } else {
-            unknownMask = setBit(unknownMask, i);
-            nStars++;
-        }
-    }
-
-    // The max lower bits we need
-    Bits lowStars = getMaskNumber(unknownMask, r);
+    Bits knownMask, unknownMask;
+    patternBits(hashPlan(r), values, nattrs(r), &knownMask, &unknownMask);
 
     // Compute page
     int nBuckets;
-    Bits *buckets = computePage(knownMask, unknownMask, nStars, lowStars, &nBuckets, r);
+    PageID *buckets = computePage(knownMask, unknownMask, &nBuckets, r);
 
-    // Get the current page;
-    PageID pid = getMaskNumber(buckets[0], r);
-    Page cur = getPage(dataFile(r), pid);
-    
-    int index = 0;
-    
     free(values);
     
     // Set all values
@@ -89,70 +81,196 @@ Selection startSelection(Reln r, char *q)
     new->known = knownMask;
     new->unknown = unknownMask;
     
-    new->curpage = cur;
-    new->curpageID = pid;
-    new->is_ovflow = 0;
-    
-    new->curtupOffset = 0;
     new->buckets = buckets;
-    new->bucketIndex = index;
+    new->bucketIndex = 0;
     new->nBuckets = nBuckets;
-    new->count = 0;
+    new->lastBucket = nBuckets - 1;
+    new->pool = bufPool(r);
+    new->prefetch = PREFETCH;
+    new->prefetched = 0;
     
     new->pattern = tuple;
+    new->match = newMatcher(tuple, nattrs(r));
+    new->filtered = 0;
+
+    // Exact-match values can be tested against compressed pages
+    // before their tuples are decoded
+    new->exactbuf = copyString(matchTuple);
+    new->exact = splitTuple(new->exactbuf, nattrs(r));
+    new->nexact = 0;
+    for (int i = 0; i < nattrs(r); i++) {
+        if (hasValue(new->exact[i])) {
+            new->nexact++;
+        } else {
+            new->exact[i] = NULL;
+        }
+    }
+    new->codes = malloc(nattrs(r) * sizeof(int));
+    assert(new->codes != NULL);
+
+    // Get the current page;
+    PageID pid = buckets[0];
+    new->curpage = pinPage(new->pool, dataFile(r), pid);
+    new->curpageID = pid;
+    new->is_ovflow = 0;
+    new->curtup = 0;
     
     return new;
 }
 
 // get next tuple during a scan
+// the tuple may be in q's own buffer, so it is only valid
+// until the next call
 
 Tuple getNextTuple(Selection q)
 {
-    // END OF ALL
-    if (q->curpage == NULL) {
-        return NULL;
-    }
-    
-    // Current Page
-    Page p = q->curpage;
-    // Starting position
-    char *base = pageData(p);
-    
-    int free = pageFreeSpace(p);
-    int pageSize = PAGESIZE - free;
-    int nTuple = pageNTuples(p);
-    
-    while (q->count < nTuple && q->curtupOffset < pageSize) {
-        Tuple t = (Tuple)(base + q->curtupOffset);
-        int len = tupLength(t);
-        
-        char  buf[MAXTUPLEN];
-        tupleString(t, buf);
-        
-        q->curtupOffset += len + 1;
-        q->count++;
-        
-        // Match
-        if (tupleMatch(q->rel, t, q->pattern)) {
-            return t;
+    // Scan the current page, then move on through
+    // its overflow chain and the remaining buckets
+    if (q->prefetched == 0) prefetchAhead(q);
+    while (q->curpage != NULL) {
+        Page p = q->curpage;
+        Tuple t;
+        if (q->curtup == 0 && !markPage(q)) {
+            // No tuple in the page holds the pattern's rarest literal
+            getNextPage(q);
+            continue;
+        }
+        int encoded = q->nexact > 0 && pageIsCompressed(p);
+        if (encoded || pageIsHashed(p)) {
+            // Only look at tuples whose stored hash agrees with the
+            // known bits, and only decode those whose encoded values match
+            if (q->curtup == 0 && encoded) encodeExact(q);
+            int hashed = pageIsHashed(p);
+            while (q->curtup < pageNSlots(p)) {
+                Count slot = q->curtup++;
+                if (hashed && (pageTupleHash(p, slot) & ~q->unknown) != q->known) {
+                    continue;
+                }
+                if (encoded && !pageMatchEncoded(p, slot, q->exact, q->codes, nattrs(q->rel))) {
+                    continue;
+                }
+                t = pageTuple(p, slot, q->tupbuf);
+                if (t == NULL || (q->filtered && !regionHit(q->match, t))) {
+                    continue;
+                }
+                if (matchTuple(q->match, t)) {
+                    return t;
+                }
+            }
+        } else {
+            while ((t = pageNextTuple(p, &q->curtup, q->tupbuf)) != NULL) {
+                // Match, if the literal is in this tuple
+                if (q->filtered && !regionHit(q->match, t)) {
+                    continue;
+                }
+                if (matchTuple(q->match, t)) {
+                    return t;
+                }
+            }
         }
+        getNextPage(q);
     }
-    
-    getNextPage(q);
-    return getNextTuple(q);
+    // END OF ALL
+    return NULL;
+}
+
+// a copy of selection q for another thread to scan some of q's
+// buckets with (see selectBucket); it has its own buffer pool and
+// matcher, and must be closed before q is
+
+Selection forkSelection(Selection q)
+{
+    // startSelection splits the string it is given
+    char *pattern = copyString(q->pattern);
+    Selection new = startSelection(q->rel, pattern);
+    free(pattern);
+    unpinPage(new->pool, new->curpage, FALSE);
+    new->curpage = NULL;
+    new->pool = forkBufPool(bufPool(q->rel), FORKFRAMES);
+    new->prefetch = q->prefetch;
+    return new;
+}
+
+// restart the scan at the b'th of the buckets the selection visits
+// (0 <= b < selectionBuckets(q)); getNextTuple then returns the
+// matching tuples of that bucket, and no others
+
+void selectBucket(Selection q, int b)
+{
+    assert(b >= 0 && b < q->nBuckets);
+    if (q->curpage != NULL) unpinPage(q->pool, q->curpage, FALSE);
+    q->bucketIndex = b;
+    q->lastBucket = b;
+    q->prefetched = 0;
+    q->curpageID = q->buckets[b];
+    q->curpage = pinPage(q->pool, dataFile(q->rel), q->curpageID);
+    q->is_ovflow = 0;
+    q->curtup = 0;
+}
+
+// how many buckets the selection visits
+
+int selectionBuckets(Selection q)
+{
+    return q->nBuckets;
+}
+
+// delete every tuple matching the selection from the relation
+// only the buckets the selection would scan are visited
+// returns the number of tuples deleted
+
+Count deleteSelection(Selection q)
+{
+    return deleteFromRelation(q->rel, q->buckets, q->nBuckets, q->pattern);
+}
+
+// change every tuple matching the selection, giving attribute i the
+// i'th value in set ("?" leaves it as it is)
+// returns the number of tuples updated
+
+Count updateSelection(Selection q, char *set)
+{
+    return updateRelation(q->rel, q->buckets, q->nBuckets, q->pattern, set);
 }
 
 // clean up a SelectionRep object and associated data
 
 void closeSelection(Selection q)
 {
-    free(q->curpage);
+    if (q->curpage != NULL) unpinPage(q->pool, q->curpage, FALSE);
+    if (q->pool != bufPool(q->rel)) freeBufPool(q->pool);
     free(q->pattern);
+    freeMatcher(q->match);
+    free(q->exact);
+    free(q->exactbuf);
+    free(q->codes);
     free(q->buckets);
     free(q);
 }
 
-// Check if an vi is known or unknown
+// the hash bits fixed by the values of a pattern (known) and those
+// left open by its '?' and '%' values (unknown), under hash plan p
+
+void patternBits(HashPlan *p, char **values, int nvals, Bits *known,
+                 Bits *unknown)
+{
+    // Hash the given values with the hash plan; the bits that
+    // come from attributes without a value are unknown
+    Bits attHash[nvals];
+    *unknown = 0;
+    for (int i = 0; i < p->nrefs; i++) {
+        int attrNum = p->refs[i];
+        if (hasValue(values[attrNum])) {
+            attHash[attrNum] = p->hash((unsigned char *)values[attrNum],
+                                       strlen(values[attrNum]));
+        } else {
+            attHash[attrNum] = 0;
+            *unknown |= planMask(p, attrNum);
+        }
+    }
+    *known = planHash(p, attHash) & ~*unknown;
+}
+
 int hasValue(char *str) {
     if (strcmp(str, "?") == 0) {
         return 0;
@@ -163,60 +281,106 @@ int hasValue(char *str) {
     }
 }
 
+// set how many buckets ahead of the scan to prefetch (0 = none)
+
+void setPrefetch(Selection q, int depth)
+{
+    q->prefetch = (depth < 0) ? 0 : depth;
+}
+
 // Compute pages
-Bits *computePage(Bits known, Bits unknown, int nStars, Bits lowerBits, int *nBuckets, Reln r) {
-    // The wild card position       
+// Lists every primary page that may hold a matching tuple:
+// take all combinations of the unknown bits among the lower
+// depth bits; a bucket below the split pointer has already been
+// split, so bit depth decides between it and its buddy
+PageID *computePage(Bits known, Bits unknown, int *nBuckets, Reln r) {
+    int d = depth(r);
+    Offset sp = splitp(r);
+
+    // The wild card positions among the lower d bits
     int starPos[32];
     int k = 0;
-    for (int i = 0; i < 32; i++) {
-        if (lowerBits & (1u << i)) {
+    for (int i = 0; i < d; i++) {
+        if (unknown & (1u << i)) {
             starPos[k] = i;
             k++;
         }
     }
+    Bits lowMask = (d == 0) ? 0 : getLower(~0u, d);
+    Bits hiBit = 1u << d;
 
-    // Total size
-    int size = 1 << k;
-    if (size >= npages(r)) {
-        size = npages(r);
-    }
-    *nBuckets = size;
-
-    Bits *pages = malloc(sizeof(Bits) * size);
+    // Each combination gives at most two pages
+    PageID *pages = malloc(sizeof(PageID) * 2 * (1u << k));
     assert(pages != NULL);
 
-    for (int mask = 0; mask < size; ++mask) {
-        Bits value =known;
+    int size = 0;
+    for (Bits mask = 0; mask < (1u << k); ++mask) {
+        Bits value = known & lowMask;
         for (int j = 0; j < k; ++j) {
-            Bits bitMask = 1u << starPos[j];
-            if (mask & (1 << j)) {
-                value |= bitMask;
+            if (mask & (1u << j)) {
+                value |= 1u << starPos[j];
             } else {
-                value &= ~bitMask;
+                value &= ~(1u << starPos[j]);
             }
         }
-        pages[mask] = value;
+        if (value >= sp) {
+            pages[size++] = value;
+        } else if (unknown & hiBit) {
+            pages[size++] = value;
+            pages[size++] = value | hiBit;
+        } else {
+            pages[size++] = value | (known & hiBit);
+        }
     }
+    *nBuckets = size;
 
-    char buf1[MAXBITS+5];
-    char buf2[MAXBITS+5];
-    bitsString(unknown, buf1);
-    bitsString(known, buf2);
-    
-    for (int i=0;i<size;i++) {
-        char t[MAXBITS+5];
-        bitsString(pages[i], t);
-    }
+    // Visit buckets in file order
+    qsort(pages, size, sizeof(PageID), cmpPageID);
 
     return pages;
-    // return NULL;
 }
 
-Bits getMaskNumber(Bits page, Reln r) {
-    int lowerBits = (splitp(r) == 0) ? depth(r) : depth(r) + 1;
-    Bits lowMask = (lowerBits == 32) ? ~0u : ((1u << lowerBits) - 1);
-    Bits number = page & lowMask;
-    return number;
+int cmpPageID(const void *a, const void *b) {
+    PageID x = *(PageID *)a, y = *(PageID *)b;
+    return (x > y) - (x < y);
+}
+
+// hint the buffer pool about pages the scan will want soon:
+// the next page of the current chain (if known), and the
+// primary pages of the next few buckets
+void prefetchAhead(Selection q) {
+    Reln r = q->rel;
+    if (q->prefetch == 0) return;
+    if (q->curpage != NULL && pageOvflow(q->curpage) != NO_PAGE) {
+        prefetchPage(q->pool, ovflowFile(r), pageOvflow(q->curpage));
+    }
+    int limit = q->bucketIndex + 1 + q->prefetch;
+    if (limit > q->lastBucket + 1) limit = q->lastBucket + 1;
+    if (q->prefetched <= q->bucketIndex) q->prefetched = q->bucketIndex + 1;
+    while (q->prefetched < limit) {
+        prefetchPage(q->pool, dataFile(r), q->buckets[q->prefetched]);
+        q->prefetched++;
+    }
+}
+
+// look up the exact-match values in the current page's dictionary
+void encodeExact(Selection q) {
+    for (int i = 0; i < nattrs(q->rel); i++) {
+        q->codes[i] = (q->exact[i] == NULL) ? -1 : pageDictCode(q->curpage, q->exact[i]);
+    }
+}
+
+// find where the pattern's rarest literal is in all of the current
+// page's tuples at once, so tuples without it can be skipped
+// returns 0 if no tuple in the page holds it
+int markPage(Selection q) {
+    char *recs;
+    Count n = 0;
+    if (matchAnchored(q->match)) {
+        n = pageRecords(q->curpage, &recs);
+    }
+    q->filtered = n > 0;
+    return n == 0 || markRegion(q->match, recs, n);
 }
 
 void getNextPage(Selection q) {
@@ -227,15 +391,15 @@ void getNextPage(Selection q) {
     Page old = q->curpage;
     
     PageID ovID = pageOvflow(old);
-    // free(old);
+    unpinPage(q->pool, old, FALSE);
     if (ovID != NO_PAGE) {
         
-        q->curpage = getPage(ovflowFile(r), ovID);
+        q->curpage = pinPage(q->pool, ovflowFile(r), ovID);
 
-        q->curtupOffset = 0;
+        q->curtup = 0;
         q->curpageID = ovID;
         q->is_ovflow = 1;
-        q->count = 0;
+        prefetchAhead(q);
 
         return;
     }
@@ -243,19 +407,15 @@ void getNextPage(Selection q) {
     // Go to the next bucket
     q->is_ovflow = 0;
     q->bucketIndex++;
-    if (q->bucketIndex >= q->nBuckets) {
+    if (q->bucketIndex > q->lastBucket) {
         // End of buckets
         q->curpage = NULL;
         return;
     }
     
-    PageID pid = getMaskNumber(q->buckets[q->bucketIndex], r);
-    if (pid >= npages(r)) {
-        pid =  pid % npages(r);
-    }
-    
-    q->curpage = getPage(dataFile(r), pid);
+    PageID pid = q->buckets[q->bucketIndex];
+    q->curpage = pinPage(q->pool, dataFile(r), pid);
     q->curpageID = pid;
-    q->curtupOffset = 0;
-    q->count = 0;
-}
\ No newline at end of file
+    q->curtup = 0;
+    prefetchAhead(q);
+}
@@ -10,6 +10,15 @@ typedef struct SelectionRep *Selection;
 
 Selection startSelection(Reln, char *);
 Tuple getNextTuple(Selection);
+void setPrefetch(Selection, int);
+Selection forkSelection(Selection);
+void selectBucket(Selection, int);
+int selectionBuckets(Selection);
+Count deleteSelection(Selection);
+Count updateSelection(Selection, char *);
 void closeSelection(Selection);
+void patternBits(HashPlan *p, char **values, int nvals, Bits *known,
+                 Bits *unknown);
+PageID *computePage(Bits known, Bits unknown, int *nBuckets, Reln r);
 
 #endif
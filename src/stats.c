@@ -19,7 +19,7 @@ int main(int argc, char **argv)
 
 	if (!existsRelation(relname))
 		fatal("No such relation\n");
-	Reln r = openRelation(relname,"r");
+	Reln r = openRelation(relname,"rm");
 	if (r == NULL) fatal("No such relation");
 
 	relationStats(r);
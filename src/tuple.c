@@ -2,6 +2,7 @@
 
 #include "defs.h"
 #include "tuple.h"
+#include "match.h"
 #include "reln.h"
 #include "hash.h"
 #include "chvec.h"
@@ -15,23 +16,93 @@ int tupLength(Tuple t)
 	return strlen(t);
 }
 
+// A TupleReader parses tuples out of an input stream
+// - input is read in blocks of READBUF bytes; line ends are found with
+//   memchr and each line's newline is overwritten with '\0', so a
+//   tuple is just a pointer into the block (no copying, no malloc)
+// - a tuple stays valid until the next call to nextTuple(); callers
+//   that keep tuples longer must copy them
+// - a partial line at the end of a block is moved to the front
+//   before the next block is read after it
+// - a line too long for a tuple (MAXTUPLEN-1 chars) is a fatal error;
+//   a line with the wrong number of fields ends the input, as it
+//   always has
+
+struct TupleReaderRep {
+	Reln   r;
+	FILE  *in;
+	char  *buf;     // READBUF bytes, plus one for a final '\0'
+	Count  start;   // first unparsed byte in buf
+	Count  end;     // end of data in buf
+	Count  lineno;  // lines returned so far
+	Bool   eof;     // no more to read from in
+};
+
+TupleReader newTupleReader(Reln r, FILE *in)
+{
+	TupleReader rd = malloc(sizeof(struct TupleReaderRep));
+	assert(rd != NULL);
+	rd->r = r;
+	rd->in = in;
+	rd->buf = malloc(READBUF+1);
+	assert(rd->buf != NULL);
+	rd->start = rd->end = 0;
+	rd->lineno = 0;
+	rd->eof = FALSE;
+	return rd;
+}
+
+void freeTupleReader(TupleReader rd)
+{
+	free(rd->buf);
+	free(rd);
+}
+
 // reads/parses next tuple in input
+// returns NULL at end of input or on an invalid tuple
 
-Tuple readTuple(Reln r, FILE *in)
+Tuple nextTuple(TupleReader rd)
 {
-	char line[MAXTUPLEN];
-	if (fgets(line, MAXTUPLEN-1, in) == NULL)
-		return NULL;
-	line[strlen(line)-1] = '\0';
-	char *c; int nf = 1;
-	for (c = line; *c != '\0'; c++)
-		if (*c == ',') nf++;
+	char *line, *nl;
+	for (;;) {
+		line = rd->buf + rd->start;
+		Count len = rd->end - rd->start;
+		nl = memchr(line, '\n', len);
+		if (nl != NULL) break;
+		if (len >= MAXTUPLEN) break;
+		if (rd->eof) {
+			// last line may have no newline
+			if (len == 0) return NULL;
+			nl = line + len;
+			break;
+		}
+		// keep the partial line and read more after it
+		memmove(rd->buf, line, len);
+		rd->start = 0;
+		rd->end = len;
+		size_t n = fread(rd->buf+len, 1, READBUF-len, rd->in);
+		if (n == 0) rd->eof = TRUE;
+		rd->end += n;
+	}
+	rd->lineno++;
+	if (nl == NULL || nl - line >= MAXTUPLEN) {
+		char err[MAXERRMSG];
+		sprintf(err, "Line %d is longer than %d chars", rd->lineno,
+		        MAXTUPLEN-1);
+		fatal(err);
+	}
+	*nl = '\0';
+	rd->start = nl+1 - rd->buf;
+	if (rd->start > rd->end) rd->start = rd->end;
 	// invalid tuple
-	if (nf != nattrs(r)) return NULL;
-	return copyString(line); // needs to be free'd sometime
+	int nf = 1;
+	for (char *c = line; (c = memchr(c, ',', nl-c)) != NULL; c++) nf++;
+	if (nf != nattrs(rd->r)) return NULL;
+	return line;
 }
 
 // extract values into an array of strings
+// doesn't modify t, which may point into a read-only page
 
 void tupleVals(Tuple t, char **vals)
 {
@@ -39,18 +110,14 @@ void tupleVals(Tuple t, char **vals)
 	int i = 0;
 	for (;;) {
 		while (*c != ',' && *c != '\0') c++;
-		if (*c == '\0') {
-			// end of tuple; add last field to vals
-			vals[i++] = copyString(c0);
-			break;
-		}
-		else {
-			// end of next field; add to vals
-			*c = '\0';
-			vals[i++] = copyString(c0);
-			*c = ',';
-			c++; c0 = c;
-		}
+		int len = c - c0;
+		char *v = malloc(len+1);
+		assert(v != NULL);
+		memcpy(v, c0, len);
+		v[len] = '\0';
+		vals[i++] = v;
+		if (*c == '\0') break;
+		c++; c0 = c;
 	}
 }
 
@@ -65,92 +132,116 @@ void freeVals(char **vals, int nattrs)
     free(vals);
 }
 
-// hash a tuple using the choice vector
+// find the attributes p uses in t: the j'th one (refs[j]) is
+// keys[j*stride], lens[j*stride] chars long
 
-Bits tupleHash(Reln r, Tuple t)
+static void planSlices(HashPlan *p, Tuple t, unsigned char **keys,
+                       int *lens, Count stride)
 {
-	// printChVec(cvs); // for debug
-	char buf[MAXBITS+5];  //*** for debug
-
-	// Combined Bit
-	Bits combined = 0;
+	char *c = t;
+	Count a = 0;
+	for (Count j = 0; j < p->nrefs; j++) {
+		// skip to the start of the next attribute used
+		for (; a < p->refs[j]; a++) {
+			c = strchr(c, ',');
+			assert(c != NULL);
+			c++;
+		}
+		keys[j*stride] = (unsigned char *)c;
+		lens[j*stride] = strcspn(c, ",");
+	}
+}
 
-	// Choice vectors
-	ChVecItem *cvs = chvec(r);
+// hash a tuple using the choice vector
+// only the attributes the choice vector uses are hashed, in place,
+// and the relation's HashPlan combines them (see chvec.c)
 
-	// Number of attributes
-	Count nvals = nattrs(r);
-    char **vals = malloc(nvals*sizeof(char *));
-    assert(vals != NULL);
+Bits tupleHash(Reln r, Tuple t)
+{
+	HashPlan *p = hashPlan(r);
+	Bits attHash[p->refs[p->nrefs-1]+1];
+	unsigned char *keys[p->nrefs];
+	int lens[p->nrefs];
+	planSlices(p, t, keys, lens, 1);
+	for (Count j = 0; j < p->nrefs; j++)
+		attHash[p->refs[j]] = p->hash(keys[j], lens[j]);
+	return planHash(p, attHash);
+}
 
-	// Parse the tuple into its individual attribute strings.
-    tupleVals(t, vals);
+// hash n tuples, as tupleHash, into hs[0..n-1]
+// - their values are hashed together (see hashBatch), HASHCHUNK
+//   tuples at a time; values of the same attribute sit side by
+//   side, so lanes that share a vector have similar lengths
 
-	// Take an attribute and its length to produce a 32-bit hash
-	// Hash all attributes and store in the array
-	Bits attrHashs[nvals];
-	for (int i = 0; i < nvals; i++) {
-		attrHashs[i] = hash_any((unsigned char *)vals[i],strlen(vals[i]));
-	}
+#define HASHCHUNK 64
 
-	// Loop cvs and fill the combined hash
-	for (int i = 0; i < 32; i++) {
-		int attrNum = cvs[i].att;
-		int bitPos = cvs[i].bit;
-
-		// printf("attrNum: %d, bitPos: %d", attrNum, bitPos); // Debug
-		// Hash
-		Bits hash = attrHashs[attrNum];
-		// Set on the combined hash
-		if (bitIsSet(hash, bitPos)) {
-			combined = setBit(combined, i);
-		} else {
-			combined = unsetBit(combined, i);
+void tupleHashes(Reln r, Tuple *ts, Count n, Bits *hs)
+{
+	HashPlan *p = hashPlan(r);
+	Count nr = p->nrefs;
+	Bits attHash[p->refs[nr-1]+1];
+	unsigned char *keys[HASHCHUNK*nr];
+	int lens[HASHCHUNK*nr];
+	Bits vals[HASHCHUNK*nr];
+	for (Count i0 = 0; i0 < n; i0 += HASHCHUNK) {
+		Count m = (n - i0 < HASHCHUNK) ? n - i0 : HASHCHUNK;
+		for (Count i = 0; i < m; i++)
+			planSlices(p, ts[i0+i], &keys[i], &lens[i], m);
+		hashBatch(p->hash, keys, lens, vals, m*nr);
+		for (Count i = 0; i < m; i++) {
+			for (Count j = 0; j < nr; j++)
+				attHash[p->refs[j]] = vals[j*m + i];
+			hs[i0+i] = planHash(p, attHash);
 		}
 	}
+}
 
-	bitsString(combined,buf);  //*** for debug
-	// printf("hash(%s) = %s\n", vals[0], buf);  //*** for debug
+// build in buf a copy of tuple t with some values replaced
+// set gives a new value for each attribute, or "?" to keep t's
+// returns ~OK if the result would be too long for a tuple
 
-    freeVals(vals,nvals);
-	return combined;
+Status tupleAssign(Tuple t, Tuple set, char *buf)
+{
+	char *c = t, *v = set, *out = buf;
+	for (;;) {
+		char *ce = strchr(c, ','), *ve = strchr(v, ',');
+		Count tlen = (ce == NULL) ? strlen(c) : ce - c;
+		Count vlen = (ve == NULL) ? strlen(v) : ve - v;
+		Bool keep = (vlen == 1 && *v == '?');
+		char *src = keep ? c : v;
+		Count len = keep ? tlen : vlen;
+		if (out - buf + len + 1 >= MAXTUPLEN) return ~OK;
+		memcpy(out, src, len);
+		out += len;
+		if (ce == NULL || ve == NULL) break;
+		*out++ = ',';
+		c = ce+1; v = ve+1;
+	}
+	*out = '\0';
+	return OK;
 }
 
-// compare two tuples (allowing for "unknown" values)
+// compare a tuple with a pattern (allowing for "unknown" values)
+// works on both in place; a scan should compile its pattern once
+// with newMatcher instead
+
 Bool tupleMatch(Reln r, Tuple pt, Tuple t)
 {
-	Count na = nattrs(r);
-
-	char **pv = malloc(na*sizeof(char *));
-	assert(pv != NULL);
-	tupleVals(pt, pv);
-
-	char **tv = malloc(na*sizeof(char *));
-	assert(tv != NULL);
-	tupleVals(t, tv);
-
-	Bool match = TRUE;
-	for (int i = 0; i < na; i++) {
-		char *pat = trim(tv[i]);
-		// Wld Card
-		if (strcmp(pat, "?") == 0) {
-			continue;
-		}
-		// Exact Match
-		if (strcmp(pv[i], pat) == 0) {
-			continue;
-		}
-		// Pattern
-		if (patternMatch(pat, pv[i]) == 1) {
-			continue;
-		}
-		match = FALSE;
-		break;
+	char *c = pt, *v = t;
+	for (Count i = 0; i < nattrs(r); i++) {
+		Count clen = strcspn(c, ","), vlen = strcspn(v, ",");
+		char *pat = v;
+		Count plen = vlen;
+		while (plen > 0 && *pat == ' ') { pat++; plen--; }
+		while (plen > 0 && pat[plen-1] == ' ') plen--;
+		// Wild card, or exact match or pattern
+		if (!(plen == 1 && *pat == '?') && !likeMatch(pat, plen, c, clen))
+			return FALSE;
+		c += clen; v += vlen;
+		if (*c == ',') c++;
+		if (*v == ',') v++;
 	}
-
-	freeVals(pv,na); 
-	freeVals(tv,na);
-	return match;
+	return TRUE;
 }
 
 // puts printable version of tuple in user-supplied buffer
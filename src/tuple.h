@@ -6,16 +6,21 @@
 #define TUPLE_H 1
 
 typedef char *Tuple;
+typedef struct TupleReaderRep *TupleReader;
 
 #include "reln.h"
 #include "bits.h"
 
 int tupLength(Tuple t);
-Tuple readTuple(Reln r, FILE *in);
+TupleReader newTupleReader(Reln r, FILE *in);
+void freeTupleReader(TupleReader rd);
+Tuple nextTuple(TupleReader rd);
 Bits tupleHash(Reln r, Tuple t);
+void tupleHashes(Reln r, Tuple *ts, Count n, Bits *hs);
 void tupleVals(Tuple t, char **vals);
 void freeVals(char **vals, int nattrs);
 Bool tupleMatch(Reln r, Tuple pt, Tuple t);
+Status tupleAssign(Tuple t, Tuple set, char *buf);
 void tupleString(Tuple t, char *buf);
 void freeTuple(Tuple t); //** release memory used for tuple
 
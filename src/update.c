@@ -0,0 +1,71 @@
+// update.c ... change tuples in a Relation
+// Gives new values to some attributes of every tuple matching a query
+// Usage:  ./update  [-v]  RelName  set  'u1,u2,u3,u4,...'  where  'v1,v2,v3,v4,...'
+// - Any ui can be '?' to leave that attribute unchanged
+// - Any vi can be '?' to indicate an unknown value
+// - Any vi can contain '%' as a wildcard matching zero or more characters
+// Tuples are changed in place where they can be; a tuple whose new
+// values hash it to another bucket is moved there
+
+#include "defs.h"
+#include "select.h"
+#include "tuple.h"
+#include "reln.h"
+
+#define USAGE "./update  [-v]  RelName  set  u1,u2,u3,u4,...  where  v1,v2,v3,v4,..."
+
+// Main ... process args, run update
+
+int main(int argc, char **argv)
+{
+	Reln r;  // handle on the open relation
+	Selection s;  // handle on the selection
+	char err[MAXERRMSG+MAXRELNAME];  // buffer for error messages
+	int offset = 0; // adapt offset for options
+	int verbose = 0;  // show how many tuples changed
+	char *rname;  // name of table/file
+	char *setstr;   // new values
+	char *valstr;   // a query string of values for selection
+
+	// process command-line args
+
+	while (offset+1 < argc && argv[offset+1][0] == '-') {
+		if (strcmp(argv[offset+1], "-v") == 0)
+			verbose = 1;
+		else
+			fatal(USAGE);
+		offset += 1;
+	}
+	if (argc != offset+6) fatal(USAGE);
+	if (strcmp(argv[offset+2], "set") != 0 || strcmp(argv[offset+4], "where") != 0)
+		fatal(USAGE);
+	rname = argv[offset+1];  setstr = argv[offset+3];  valstr = argv[offset+5];
+
+	// set up relation for writing
+
+	if (!existsRelation(rname)) {
+		sprintf(err, "No such relation: %s",rname);
+		fatal(err);
+	}
+	if ((r = openRelation(rname,"r+")) == NULL) {
+		sprintf(err, "Can't open relation: %s",rname);
+		fatal(err);
+	}
+	if (nvals(setstr) != nattrs(r) || strlen(setstr) >= MAXTUPLEN) {
+		sprintf(err, "Invalid new values: %s",setstr);
+		fatal(err);
+	}
+	if (nvals(valstr) != nattrs(r) || (s = startSelection(r, valstr)) == NULL) {
+		sprintf(err, "Invalid selection: %s",valstr);
+		fatal(err);
+	}
+
+	Count n = updateSelection(s, setstr);
+	if (verbose) printf("Updated %d tuples\n", n);
+
+	// clean up
+	closeSelection(s);
+	closeRelation(r);
+
+	return 0;
+}
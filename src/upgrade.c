@@ -0,0 +1,40 @@
+// upgrade.c ... convert a Relation to the current page format
+// Rewrites relations created before slotted pages
+// Usage:  ./upgrade  RelName
+
+#include "defs.h"
+#include "reln.h"
+
+#define USAGE "./upgrade  RelName"
+
+
+// Main ... process args, upgrade relation
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG+MAXRELNAME];  // buffer for error messages
+
+	// process command-line args
+
+	if (argc < 2) fatal(USAGE);
+	char *relname = argv[1];
+
+	if (!existsRelation(relname))
+		fatal("No such relation");
+	Reln r = openRelation(relname,"r");
+	if (r == NULL) fatal("Can't open relation");
+	Bool legacy = isLegacyRelation(r);
+	closeRelation(r);
+	if (!legacy) {
+		printf("Relation %s is already in the current format\n", relname);
+		return 0;
+	}
+
+	// rebuild the relation in the new format
+
+	if (upgradeRelation(relname) != OK) {
+		sprintf(err, "Problems while upgrading relation %s", relname);
+		fatal(err);
+	}
+	return 0;
+}
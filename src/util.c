@@ -32,17 +32,20 @@ char *trim(char *s) {
     return s;
 }
 
-// Split the values into array
+// Split the values into array, trimming spaces from each
+// Every comma ends a value, so empty values keep their place,
+// as they do when a pattern is matched against tuples, and
+// values missing from the end are "?"
 // Caller need to free
 char **splitTuple(char *str, int len) {
     char **array = malloc(len * sizeof(char *));
     assert(array != NULL);
-    char *token = strtok(str, ",");
 
-    int i = 0;
-    while (token != NULL) {
-        array[i++] = trim(token);
-        token = strtok(NULL, ",");
+    for (int i = 0; i < len; i++) {
+        char *comma = (str == NULL) ? NULL : strchr(str, ',');
+        if (comma != NULL) *comma = '\0';
+        array[i] = (str == NULL) ? "?" : trim(str);
+        str = (comma == NULL) ? NULL : comma + 1;
     }
 
     return array;
@@ -95,4 +98,13 @@ int convert(char *s, int *out) {
 
 	*out = sign * val;
 	return 1;
-}
\ No newline at end of file
+}
+
+// number of comma-separated values in a string
+int nvals(char *s) {
+	int n = 1;
+	for (; *s != '\0'; s++) {
+		if (*s == ',') n++;
+	}
+	return n;
+}
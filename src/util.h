@@ -11,5 +11,6 @@ char *trim(char *s);
 char **splitTuple(char *str, int len);
 int patternMatch(char *p, char *t);
 int convert(char *s, int *out);
+int nvals(char *s);
 
 #endif
@@ -0,0 +1,31 @@
+// vacuum.c ... compact the overflow file of a Relation
+// Drops free overflow pages and lays out each bucket's chain
+// in consecutive pages
+// Usage:  ./vacuum  RelName
+
+#include "defs.h"
+#include "reln.h"
+
+#define USAGE "./vacuum  RelName"
+
+
+// Main ... process args, vacuum relation
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG+MAXRELNAME];  // buffer for error messages
+
+	// process command-line args
+
+	if (argc < 2) fatal(USAGE);
+	char *relname = argv[1];
+
+	if (!existsRelation(relname))
+		fatal("No such relation");
+
+	if (vacuumRelation(relname) != OK) {
+		sprintf(err, "Problems while vacuuming relation %s", relname);
+		fatal(err);
+	}
+	return 0;
+}
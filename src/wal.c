@@ -0,0 +1,447 @@
+// wal.c ... write-ahead log of page images
+// Makes batches of changes to a relation durable with one fsync
+
+#define _POSIX_C_SOURCE 200809L
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "defs.h"
+#include "wal.h"
+#include "page.h"
+#include "hash.h"
+
+// A Wal is an append-only log (Rel.wal) between a relation's buffer
+// pool and its data and ovflow files
+// - a page written back by the pool is appended to the log as a
+//   page image, instead of overwriting the page in its file
+// - a commit record holds the relation's header words (as in .info)
+//   and is followed by an fsync; the page images since the previous
+//   commit become durable together (group commit)
+// - the latest image of a page in the log is newer than the copy in
+//   its file, so pages are read from the log when it has them
+// - a checkpoint copies the latest image of each page into its file,
+//   syncs the files, and then the log can be emptied
+// - on open, the log is scanned up to its last intact commit record;
+//   anything after that is a batch that never committed, and is
+//   ignored (and overwritten by the next batch)
+// - every record carries a checksum, so a torn write ends the log
+// - records are gathered in a buffer of WALBUFPAGES page images and
+//   written with one system call when it fills or at commit
+// - checkpoints and flushes write pages in (file,pageID) order
+// Files only ever receive committed page images (at checkpoints), so
+// recovery never has to undo anything; the only other writes to the
+// files are the empty pages that addPage appends
+// A writer holds a lock on the log, so only one process updates the
+// relation at a time; other writers wait for it in openWal
+// Readers don't take the lock, so a writer's checkpoint can empty the
+// log under a reader that indexed it; a reader checks each image it
+// reads, and goes to the file (which the checkpoint has brought up to
+// date) when the record it indexed is no longer there
+
+typedef struct {
+	Count  magic;  // WAL_MAGIC
+	Count  type;   // WAL_PAGE or WAL_COMMIT
+	Count  file;   // index of file holding page (WAL_PAGE)
+	PageID pid;    // page within file (WAL_PAGE)
+	Count  len;    // #bytes following the record header
+	Count  sum;    // checksum of header (with sum = 0) and bytes
+} WalRec;
+
+typedef struct {
+	Count  file;   // index of file, or NO_FILE if slot unused
+	PageID pid;    // page within file
+	off_t  off;    // offset of latest image in log
+} WalEntry;
+
+#define WAL_MAGIC   0x57414c31
+#define WAL_PAGE    1
+#define WAL_COMMIT  2
+#define MAXWALFILES 2
+#define WALBUFPAGES 32
+#define NO_FILE     0xffffffff
+
+struct WalRep {
+	int    fd;       // log file
+	Bool   locked;   // held by a writer (nobody else empties it)
+	Count  pagesize; // #bytes in each page image
+	FILE  *files[MAXWALFILES]; // files whose pages are logged
+	Count  nfiles;   // #entries in files[]
+	off_t  end;      // where the next record goes
+	char  *buf;      // records not yet written to the log
+	Count  nbuf;     // #bytes in buf (they end at end)
+	Count  bufsize;  // #bytes buf can hold
+	off_t  commit;   // end of last commit record
+	Count  nhdr;     // #words in last commit's header
+	Count  *hdr;     // header words from last commit (or NULL)
+	WalEntry *index; // (file,pid) -> latest image in log
+	Count  nindex;   // #slots in index (power of 2)
+	Count  nused;    // #slots in use
+	Count  nimages;  // #page images in log
+	// statistics
+	Count  nlogged;  // #page images written
+	Count  ncommits; // #commits (and fsyncs)
+	Count  nwrites;  // #writes to the log file
+};
+
+// Helpers
+static Count fileIndex(Wal w, FILE *f);
+static WalEntry *findEntry(Wal w, Count file, PageID pid);
+static void addEntry(Wal w, Count file, PageID pid, off_t off);
+static void clearIndex(Wal w, Count nindex);
+static Count checksum(WalRec *rec, void *bytes);
+static void appendRecord(Wal w, WalRec *rec, void *bytes);
+static void flushWal(Wal w);
+static int cmpEntry(const void *a, const void *b);
+static void scanWal(Wal w);
+
+// open the log called name for pages of pagesize bytes from files
+// if writable, the log is created if needed and locked, once any
+// other writer has let it go
+// otherwise returns NULL if there is no log or nothing committed in it
+
+Wal openWal(char *name, Count pagesize, FILE **files, Count nfiles,
+            Bool writable)
+{
+	assert(nfiles <= MAXWALFILES);
+	int fd = open(name, writable ? O_RDWR|O_CREAT : O_RDONLY, 0644);
+	if (fd < 0) {
+		if (!writable) return NULL;
+		fatal("Can't open write-ahead log");
+	}
+	if (writable) {
+		// wait for any other writer to finish with it
+		struct flock lk = { .l_type = F_WRLCK, .l_whence = SEEK_SET };
+		if (fcntl(fd, F_SETLKW, &lk) < 0) {
+			char err[MAXERRMSG+MAXFILENAME];
+			sprintf(err, "Can't lock %s", name);
+			fatal(err);
+		}
+	}
+	Wal w = malloc(sizeof(struct WalRep));
+	assert(w != NULL);
+	w->fd = fd;
+	w->locked = writable;
+	w->pagesize = pagesize;
+	for (Count i = 0; i < nfiles; i++) w->files[i] = files[i];
+	w->nfiles = nfiles;
+	w->hdr = NULL;
+	w->nhdr = 0;
+	w->index = NULL;
+	clearIndex(w, 64);
+	w->nimages = 0;
+	w->bufsize = WALBUFPAGES*(sizeof(WalRec) + pagesize);
+	w->buf = malloc(w->bufsize);
+	assert(w->buf != NULL);
+	w->nbuf = 0;
+	w->nlogged = w->ncommits = w->nwrites = 0;
+	scanWal(w);
+	if (!writable && w->hdr == NULL) {
+		closeWal(w);
+		return NULL;
+	}
+	return w;
+}
+
+// release the log (and its lock)
+
+void closeWal(Wal w)
+{
+	close(w->fd);
+	free(w->buf);
+	free(w->hdr);
+	free(w->index);
+	free(w);
+}
+
+// copy the header words from the last commit into hdr[0..nhdr-1]
+// words missing from the commit keep the values given in hdr
+// returns FALSE (and leaves hdr alone) if nothing has been committed
+
+Bool walHeader(Wal w, Count *hdr, Count nhdr)
+{
+	if (w->hdr == NULL) return FALSE;
+	Count n = (w->nhdr < nhdr) ? w->nhdr : nhdr;
+	memcpy(hdr, w->hdr, n*sizeof(Count));
+	return TRUE;
+}
+
+// append an image of page pid of file f to the log
+// it is not durable until the next walCommit()
+
+void walLogPage(Wal w, FILE *f, PageID pid, Page p)
+{
+	WalRec rec = { WAL_MAGIC, WAL_PAGE, fileIndex(w, f), pid, w->pagesize, 0 };
+	off_t off = w->end;
+	appendRecord(w, &rec, p);
+	addEntry(w, rec.file, pid, off);
+	w->nimages++;
+	w->nlogged++;
+}
+
+// read the latest image of page pid of file f into p
+// returns FALSE if the log has no image of that page, or (for a
+// reader) if a checkpoint has emptied the log since it was indexed
+
+Bool walReadPage(Wal w, FILE *f, PageID pid, Page p)
+{
+	if (!walHasPage(w, f, pid)) return FALSE;
+	WalEntry *e = findEntry(w, fileIndex(w, f), pid);
+	off_t off = e->off + sizeof(WalRec);
+	off_t bufstart = w->end - w->nbuf;
+	if (off >= bufstart) {
+		memcpy(p, w->buf + (off - bufstart), w->pagesize);
+		return TRUE;
+	}
+	ssize_t n = pread(w->fd, p, w->pagesize, off);
+	if (w->locked) {
+		assert(n == w->pagesize);
+		return TRUE;
+	}
+	// the log may have been truncated, and even refilled by a writer
+	WalRec rec;
+	return n == w->pagesize
+	       && pread(w->fd, &rec, sizeof(rec), e->off) == sizeof(rec)
+	       && rec.magic == WAL_MAGIC && rec.type == WAL_PAGE
+	       && rec.file == e->file && rec.pid == pid
+	       && rec.len == w->pagesize && checksum(&rec, p) == rec.sum;
+}
+
+// does the log hold an image of page pid of file f?
+
+Bool walHasPage(Wal w, FILE *f, PageID pid)
+{
+	Count file = fileIndex(w, f);
+	if (file == NO_FILE || w->nused == 0) return FALSE;
+	return findEntry(w, file, pid)->file != NO_FILE;
+}
+
+// make every page logged so far durable, along with the header
+// words hdr[0..nhdr-1] that describe the relation they belong to
+
+void walCommit(Wal w, Count *hdr, Count nhdr)
+{
+	WalRec rec = { WAL_MAGIC, WAL_COMMIT, NO_FILE, NO_PAGE,
+	               nhdr*sizeof(Count), 0 };
+	appendRecord(w, &rec, hdr);
+	flushWal(w);
+	if (fsync(w->fd) < 0) fatal("Can't sync write-ahead log");
+	w->commit = w->end;
+	if (w->nhdr != nhdr) {
+		free(w->hdr);
+		w->hdr = malloc(nhdr*sizeof(Count));
+		assert(w->hdr != NULL);
+		w->nhdr = nhdr;
+	}
+	memcpy(w->hdr, hdr, nhdr*sizeof(Count));
+	w->ncommits++;
+}
+
+// write the latest image of each page in the log back to its file
+// and sync the files; call after walCommit(), and follow with
+// walTruncate() once the relation's header is safely stored
+
+void walCheckpoint(Wal w)
+{
+	assert(w->nbuf == 0);
+	// visit pages in file order
+	WalEntry *todo = malloc(w->nused*sizeof(WalEntry) + 1);
+	assert(todo != NULL);
+	Count ntodo = 0;
+	for (Count i = 0; i < w->nindex; i++) {
+		WalEntry *e = &w->index[i];
+		if (e->file != NO_FILE && e->off < w->commit) todo[ntodo++] = *e;
+	}
+	qsort(todo, ntodo, sizeof(WalEntry), cmpEntry);
+	Page buf = malloc(w->pagesize);
+	assert(buf != NULL);
+	for (Count i = 0; i < ntodo; i++) {
+		WalEntry *e = &todo[i];
+		ssize_t n = pread(w->fd, buf, w->pagesize, e->off + sizeof(WalRec));
+		assert(n == w->pagesize);
+		writePage(w->files[e->file], e->pid, buf, w->pagesize);
+	}
+	free(buf);
+	free(todo);
+	for (Count i = 0; i < w->nfiles; i++) {
+		if (fflush(w->files[i]) != 0 || fsync(fileno(w->files[i])) < 0)
+			fatal("Can't sync relation files");
+	}
+}
+
+// empty the log (after a checkpoint)
+
+void walTruncate(Wal w)
+{
+	if (ftruncate(w->fd, 0) < 0 || fsync(w->fd) < 0)
+		fatal("Can't truncate write-ahead log");
+	w->end = w->commit = 0;
+	w->nbuf = 0;
+	w->nimages = 0;
+	free(w->hdr);
+	w->hdr = NULL;
+	w->nhdr = 0;
+	clearIndex(w, w->nindex);
+}
+
+// #page images in the log
+
+Count walNPages(Wal w) { return w->nimages; }
+
+// displays log activity counters (for debugging)
+
+void walStats(Wal w)
+{
+	printf("Write-ahead log: %d images of %d pages, %ld bytes, "
+	       "%d images written, %d writes, %d commits\n", w->nimages,
+	       w->nused, (long)w->end, w->nlogged, w->nwrites, w->ncommits);
+}
+
+// index of f in the log's files, or NO_FILE
+
+static Count fileIndex(Wal w, FILE *f)
+{
+	for (Count i = 0; i < w->nfiles; i++) {
+		if (w->files[i] == f) return i;
+	}
+	return NO_FILE;
+}
+
+// index slot for (file,pid): its entry, or the empty slot where it goes
+
+static WalEntry *findEntry(Wal w, Count file, PageID pid)
+{
+	Count h = (pid * 2654435761u) ^ file;
+	h = (h ^ (h >> 16)) & (w->nindex-1);
+	while (w->index[h].file != NO_FILE) {
+		WalEntry *e = &w->index[h];
+		if (e->file == file && e->pid == pid) break;
+		h = (h+1) & (w->nindex-1);
+	}
+	return &w->index[h];
+}
+
+// note that the latest image of (file,pid) is at offset off
+
+static void addEntry(Wal w, Count file, PageID pid, off_t off)
+{
+	WalEntry *e = findEntry(w, file, pid);
+	if (e->file == NO_FILE) {
+		if (2*(w->nused+1) > w->nindex) {
+			// grow the index, re-entering everything
+			WalEntry *old = w->index;
+			Count nold = w->nindex;
+			w->index = NULL;
+			clearIndex(w, 2*nold);
+			for (Count i = 0; i < nold; i++) {
+				if (old[i].file != NO_FILE)
+					addEntry(w, old[i].file, old[i].pid, old[i].off);
+			}
+			free(old);
+			e = findEntry(w, file, pid);
+		}
+		e->file = file;
+		e->pid = pid;
+		w->nused++;
+	}
+	e->off = off;
+}
+
+// make the index an empty table of nindex slots
+
+static void clearIndex(Wal w, Count nindex)
+{
+	if (w->index == NULL || nindex != w->nindex) {
+		free(w->index);
+		w->index = malloc(nindex*sizeof(WalEntry));
+		assert(w->index != NULL);
+		w->nindex = nindex;
+	}
+	for (Count i = 0; i < nindex; i++) w->index[i].file = NO_FILE;
+	w->nused = 0;
+}
+
+// checksum of a record's header and the rec->len bytes after it
+
+static Count checksum(WalRec *rec, void *bytes)
+{
+	WalRec r = *rec;
+	r.sum = 0;
+	return hash_any((unsigned char *)&r, sizeof(r))
+	     ^ hash_any((unsigned char *)bytes, r.len);
+}
+
+// add a record (header + bytes) to the end of the log
+
+static void appendRecord(Wal w, WalRec *rec, void *bytes)
+{
+	rec->sum = checksum(rec, bytes);
+	if (w->nbuf + sizeof(WalRec) + rec->len > w->bufsize) flushWal(w);
+	memcpy(w->buf + w->nbuf, rec, sizeof(WalRec));
+	memcpy(w->buf + w->nbuf + sizeof(WalRec), bytes, rec->len);
+	w->nbuf += sizeof(WalRec) + rec->len;
+	w->end += sizeof(WalRec) + rec->len;
+}
+
+// write out the buffered records
+
+static void flushWal(Wal w)
+{
+	if (w->nbuf == 0) return;
+	if (pwrite(w->fd, w->buf, w->nbuf, w->end - w->nbuf) != w->nbuf)
+		fatal("Can't write to write-ahead log");
+	w->nbuf = 0;
+	w->nwrites++;
+}
+
+// order index entries by file, then page
+
+static int cmpEntry(const void *a, const void *b)
+{
+	const WalEntry *x = a, *y = b;
+	if (x->file != y->file) return (x->file > y->file) - (x->file < y->file);
+	return (x->pid > y->pid) - (x->pid < y->pid);
+}
+
+// find the last intact commit in the log, and index the page
+// images that it made durable
+
+static void scanWal(Wal w)
+{
+	WalRec rec;
+	off_t off = 0;
+	char *buf = malloc(w->pagesize);
+	assert(buf != NULL);
+	w->commit = 0;
+	// first pass: how far do the committed records go?
+	while (pread(w->fd, &rec, sizeof(rec), off) == sizeof(rec)) {
+		if (rec.magic != WAL_MAGIC || rec.len > w->pagesize
+		    || (rec.type == WAL_PAGE && (rec.len != w->pagesize
+		                                 || rec.file >= w->nfiles))
+		    || (rec.type != WAL_PAGE && rec.type != WAL_COMMIT))
+			break;
+		if (pread(w->fd, buf, rec.len, off + sizeof(rec)) != rec.len
+		    || checksum(&rec, buf) != rec.sum)
+			break;
+		off += sizeof(rec) + rec.len;
+		if (rec.type == WAL_COMMIT) {
+			w->commit = off;
+			free(w->hdr);
+			w->nhdr = rec.len/sizeof(Count);
+			w->hdr = malloc(rec.len);
+			assert(w->hdr != NULL);
+			memcpy(w->hdr, buf, rec.len);
+		}
+	}
+	free(buf);
+	// second pass: index the committed page images
+	for (off = 0; off < w->commit; off += sizeof(rec) + rec.len) {
+		ssize_t n = pread(w->fd, &rec, sizeof(rec), off);
+		assert(n == sizeof(rec));
+		if (rec.type == WAL_PAGE) {
+			addEntry(w, rec.file, rec.pid, off);
+			w->nimages++;
+		}
+	}
+	// an uncommitted tail will be overwritten
+	w->end = w->commit;
+}
@@ -0,0 +1,25 @@
+// wal.h ... interface to the write-ahead log
+// See wal.c for details of Wal type and functions
+
+#ifndef WAL_H
+#define WAL_H 1
+
+typedef struct WalRep *Wal;
+
+#include "defs.h"
+#include "page.h"
+
+Wal openWal(char *name, Count pagesize, FILE **files, Count nfiles,
+            Bool writable);
+void closeWal(Wal w);
+Bool walHeader(Wal w, Count *hdr, Count nhdr);
+void walLogPage(Wal w, FILE *f, PageID pid, Page p);
+Bool walHasPage(Wal w, FILE *f, PageID pid);
+Bool walReadPage(Wal w, FILE *f, PageID pid, Page p);
+void walCommit(Wal w, Count *hdr, Count nhdr);
+void walCheckpoint(Wal w);
+void walTruncate(Wal w);
+Count walNPages(Wal w);
+void walStats(Wal w);
+
+#endif